@@ -0,0 +1,113 @@
+// Per-line latency of xc --line-buffered between two pipes.
+//
+// Build: c++ -std=c++17 -O2 -o latency bench/latency.cc
+// Usage: ./latency ./xc [lines] [burst]
+//
+// Lines are written in bursts of `burst` (default 1), and each burst is
+// timed from its write until its last line has come back out of xc. The
+// delay of every line in the burst is counted from the start of the
+// burst, so p99 also shows how long a burst takes to get through.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/// @Description: Current time of the monotonic clock in nanoseconds.
+/// @Returns: now_ns returns a long long.
+static long long now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+	std::fprintf(stderr, "usage: %s XC [LINES] [BURST]\n", argv[0]);
+	return 1;
+    }
+
+    const int lines = argc > 2 ? std::atoi(argv[2]) : 20000;
+    const int burst = argc > 3 ? std::max(1, std::atoi(argv[3])) : 1;
+
+    int to_xc[2], from_xc[2];
+    if (pipe(to_xc) == -1 || pipe(from_xc) == -1) {
+	std::perror("pipe()");
+	return 1;
+    }
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, to_xc[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, from_xc[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&fa, to_xc[1]);
+    posix_spawn_file_actions_addclose(&fa, from_xc[0]);
+
+    char opt_lb[] = "--line-buffered";
+    char opt_crlf[] = "--crlf";
+    char opt_f[] = "-f";
+    char opt_in[] = "-";
+    char pattern[] = "[:blank:]$";
+    std::vector<char *> args {argv[1], opt_lb, opt_crlf, opt_f, opt_in, pattern, nullptr};
+
+    pid_t pid;
+    if (posix_spawn(&pid, argv[1], &fa, nullptr, args.data(), environ) != 0) {
+	std::perror("posix_spawn()");
+	return 1;
+    }
+    close(to_xc[0]);
+    close(from_xc[1]);
+
+    const std::string line = "2024-01-01 12:00:00 INFO request served \t\r\n";
+    std::string batch;
+    for (int i = 0; i < burst; i++) {
+	batch.append(line);
+    }
+
+    std::vector<long long> lat;
+    lat.reserve(lines);
+    char buf[64 * 1024];
+
+    for (int sent = 0; sent < lines; sent += burst) {
+	const auto t0 = now_ns();
+	if (write(to_xc[1], batch.data(), batch.size()) != static_cast<ssize_t>(batch.size())) {
+	    std::perror("write()");
+	    return 1;
+	}
+
+	for (int back = 0; back < burst;) {
+	    auto n = read(from_xc[0], buf, sizeof(buf));
+	    if (n <= 0) {
+		std::fprintf(stderr, "xc stopped early\n");
+		return 1;
+	    }
+	    const auto t = now_ns();
+	    for (ssize_t i = 0; i < n; i++) {
+		if (buf[i] == '\n') {
+		    lat.push_back(t - t0);
+		    back++;
+		}
+	    }
+	}
+    }
+
+    close(to_xc[1]);
+    waitpid(pid, nullptr, 0);
+    std::sort(lat.begin(), lat.end());
+
+    auto pct = [&lat](double p) {
+	return lat[static_cast<std::size_t>(p * (lat.size() - 1))] / 1000.0;
+    };
+    std::printf("lines %zu  burst %d  p50 %.1fus  p99 %.1fus  max %.1fus\n",
+		lat.size(), burst, pct(0.5), pct(0.99), pct(1));
+    return 0;
+}
@@ -0,0 +1,100 @@
+// Exec-to-exit latency of xc on a 1 KB input.
+//
+// Build: c++ -std=c++17 -O2 -o startup bench/startup.cc
+// Usage: ./startup ./xc [runs]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/// @Description: Current time of the monotonic clock in nanoseconds.
+/// @Returns: now_ns returns a long long.
+static long long now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/// @Description: Write 1 KB of log-like text with some control bytes.
+/// @Returns: make_input returns the path of the file.
+static std::string make_input()
+{
+    char path[] = "/tmp/xc-startup-XXXXXX";
+    auto fd = mkstemp(path);
+    if (fd == -1) {
+	std::perror("mkstemp()");
+	std::exit(1);
+    }
+
+    std::string text;
+    while (text.size() < 1024) {
+	text.append("2024-01-01 12:00:00 \x1b[1mINFO\x1b[0m request served\t \r\n");
+    }
+    text.resize(1024);
+
+    if (write(fd, text.data(), text.size()) != static_cast<ssize_t>(text.size())) {
+	std::perror("write()");
+	std::exit(1);
+    }
+    close(fd);
+    return path;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+	std::fprintf(stderr, "usage: %s XC [RUNS]\n", argv[0]);
+	return 1;
+    }
+
+    const int runs = argc > 2 ? std::atoi(argv[2]) : 2000;
+    const auto input = make_input();
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char pattern[] = "[:cntrl:]";
+    char opt_f[] = "-f";
+    std::vector<char *> args {argv[1], opt_f, const_cast<char *>(input.c_str()),
+			      pattern, nullptr};
+
+    std::vector<long long> lat;
+    lat.reserve(runs);
+    for (int i = 0; i < runs; i++) {
+	pid_t pid;
+	int status;
+	const auto t0 = now_ns();
+	if (posix_spawn(&pid, argv[1], &fa, nullptr, args.data(), environ) != 0) {
+	    std::perror("posix_spawn()");
+	    return 1;
+	}
+	waitpid(pid, &status, 0);
+	lat.push_back(now_ns() - t0);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	    std::fprintf(stderr, "xc failed\n");
+	    return 1;
+	}
+    }
+
+    unlink(input.c_str());
+    std::sort(lat.begin(), lat.end());
+
+    auto pct = [&lat](double p) {
+	return lat[static_cast<std::size_t>(p * (lat.size() - 1))] / 1000.0;
+    };
+    std::printf("runs %d  min %.1fus  p50 %.1fus  p99 %.1fus  max %.1fus\n",
+		runs, pct(0), pct(0.5), pct(0.99), pct(1));
+    return 0;
+}
@@ -0,0 +1,90 @@
+// CRC32C (Castagnoli), with the SSE4.2 instruction when the CPU has it.
+
+#ifndef CRC32C_H
+# define CRC32C_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+# include <nmmintrin.h>
+#endif
+
+namespace crc32c {
+
+/// @description: Byte-at-a-time lookup table for the reflected polynomial.
+inline constexpr std::array<std::uint32_t, 256> table = [] {
+    std::array<std::uint32_t, 256> t {};
+    for (std::uint32_t i = 0; i < 256; i++) {
+	std::uint32_t c = i;
+	for (int k = 0; k < 8; k++) {
+	    c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+	}
+	t[i] = c;
+    }
+    return t;
+}();
+
+/// @description: Portable update, used when SSE4.2 is not available.
+/// @returns: [update_soft -> std::uint32_t]
+inline std::uint32_t update_soft(std::uint32_t crc, const char *p,
+				 std::size_t n) noexcept
+{
+    while (n--) {
+	crc = table[(crc ^ static_cast<unsigned char>(*p++)) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+/// @description: Update using the crc32 instruction, 8 bytes at a time.
+/// @returns: [update_hw -> std::uint32_t]
+__attribute__((target("sse4.2")))
+inline std::uint32_t update_hw(std::uint32_t crc, const char *p,
+			       std::size_t n) noexcept
+{
+    std::uint64_t c = crc;
+    for (; n >= 8; n -= 8, p += 8) {
+	std::uint64_t w;
+	std::memcpy(&w, p, sizeof(w));
+	c = _mm_crc32_u64(c, w);
+    }
+
+    crc = static_cast<std::uint32_t>(c);
+    for (; n; n--) {
+	crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*p++));
+    }
+
+    return crc;
+}
+#endif
+
+/// @description: Running CRC32C over bytes fed in order.
+struct state {
+    std::uint32_t crc = 0xffffffff;
+
+    void update(const char *p, std::size_t n) noexcept
+    {
+#if defined(__x86_64__)
+	static const bool hw = __builtin_cpu_supports("sse4.2");
+	if (hw) {
+	    crc = update_hw(crc, p, n);
+	    return;
+	}
+#endif
+	crc = update_soft(crc, p, n);
+    }
+
+    /// @returns: [value -> std::uint32_t], the finished checksum.
+    std::uint32_t value() const noexcept
+    {
+	return crc ^ 0xffffffff;
+    }
+};
+
+} // namespace
+
+#endif
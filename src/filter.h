@@ -0,0 +1,648 @@
+// Compiled patterns and the single-pass filter engine.
+
+#ifndef FILTER_H
+# define FILTER_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "char_type.h"
+#include "simd.h"
+#include "utf8.h"
+
+namespace xc {
+
+/// @description: Classifier flags stored per byte value in a compiled pattern.
+enum : std::uint8_t {
+    F_DROP  = 1 << 0,		// Removed by a pretype, unconditionally.
+    F_QUOTA = 1 << 1,		// Removed as a literal while its quota lasts.
+    F_LEAD  = 1 << 2,		// Removed at the start of a line (^[:x:]).
+    F_TRAIL = 1 << 3,		// Removed at the end of a line ([:x:]$).
+    F_EOL   = 1 << 4,		// Ends a line, for the line-level rules.
+    F_CR    = 1 << 5,		// Dropped when it precedes a line end.
+    F_INVIS = 1 << 6,		// May lead an invisible character.
+};
+
+/// @description: Where in a line a pretype removes bytes.
+enum class anchor {
+    anywhere,
+    line_start,
+    line_end,
+};
+
+/// @description: A pretype name and the predicate it stands for.
+struct pretype {
+    std::string_view name;
+    int (*test)(int);
+};
+
+/// @description: Every pretype the pattern syntax understands.
+inline constexpr pretype pretypes[] = {
+    {"[:alnum:]",   [](int c) { return char_type::isalnum(c); }},
+    {"[:alpha:]",   [](int c) { return char_type::isalpha(c); }},
+    {"[:blank:]",   [](int c) { return char_type::isblank(c); }},
+    {"[:cntrl:]",   [](int c) { return char_type::iscntrl(c); }},
+    {"[:digit:]",   [](int c) { return char_type::isdigit(c); }},
+    {"[:graph:]",   [](int c) { return char_type::isgraph(c); }},
+    {"[:lower:]",   [](int c) { return char_type::islower(c); }},
+    {"[:print:]",   [](int c) { return char_type::isprint(c); }},
+    {"[:punct:]",   [](int c) { return char_type::ispunct(c); }},
+    {"[:space:]",   [](int c) { return char_type::isaspace(c); }},
+    {"[:htab:]",    [](int c) { return char_type::ishtab(c); }},
+    {"[:vtab:]",    [](int c) { return char_type::isvtab(c); }},
+    {"[:newline:]", [](int c) { return char_type::isnewline(c); }},
+    {"[:upper:]",   [](int c) { return char_type::isupper(c); }},
+    {"[:xdigit:]",  [](int c) { return char_type::isxdigit(c); }},
+};
+
+/// @description: Look up a pretype by its bracketed name.
+/// @returns: [find_pretype -> const pretype *], nullptr if unknown.
+constexpr inline const pretype *find_pretype(std::string_view name) noexcept
+{
+    for (const auto &p : pretypes) {
+	if (p.name == name) {
+	    return &p;
+	}
+    }
+
+    return nullptr;
+}
+
+/// @description: A pattern compiled down to one merged classifier table,
+///               so that every pretype and literal is tested in the same
+///               pass instead of one pass per pretype.
+struct pattern {
+    std::array<std::uint8_t, 256> flags {};
+    std::array<std::int64_t, 256> quota {};
+    simd::byteset scan;		// Bytes with any flag, for the fast path.
+    bool squeeze = false;	// Collapse runs of empty lines into one.
+    std::uint8_t used = 0;	// Every flag set for any byte.
+
+    // Columns removed from every line, as sorted, disjoint [from, to)
+    // ranges of 0-based byte positions; the line end is never removed.
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> cols;
+
+    /// @description: Mark every byte matched by a pretype as removable,
+    ///               anywhere or only at one end of a line.
+    void add_pretype(const pretype &p, anchor at = anchor::anywhere) noexcept
+    {
+	const auto f = at == anchor::line_start ? F_LEAD :
+	    at == anchor::line_end ? F_TRAIL : F_DROP;
+
+	for (int c = 0; c < 256; c++) {
+	    // The line end itself is never part of a leading or trailing run.
+	    if (p.test(c) && !(at != anchor::anywhere && c == '\n')) {
+		mark(static_cast<unsigned char>(c), f);
+	    }
+	}
+
+	if (at != anchor::anywhere) {
+	    mark('\n', F_EOL);
+	}
+    }
+
+    /// @description: Allow `times` more removals of the literal c. A literal
+    ///               given twice gets twice the quota, like look_for() did.
+    void add_literal(unsigned char c, std::int64_t times) noexcept
+    {
+	auto &q = quota[c];
+	q = (q > std::numeric_limits<std::int64_t>::max() - times) ?
+	    std::numeric_limits<std::int64_t>::max() : q + times;
+	if (q) {
+	    mark(c, F_QUOTA);
+	}
+    }
+
+    /// @description: Turn "\r\n" line ends into "\n".
+    void normalize_crlf() noexcept
+    {
+	mark('\r', F_CR);
+	mark('\n', F_EOL);
+    }
+
+    /// @description: Keep at most one empty line out of every run of
+    ///               them, like cat -s. A line counts as empty when
+    ///               nothing of it is left after filtering.
+    void squeeze_blank() noexcept
+    {
+	squeeze = true;
+	mark('\n', F_EOL);
+    }
+
+    /// @description: Remove zero-width characters, bidi controls and
+    ///               BOMs. Only their lead bytes are searched for; the
+    ///               bytes after one are decoded when it is found.
+    void strip_invisible() noexcept
+    {
+	mark(0xe2, F_INVIS);
+	mark(0xef, F_INVIS);
+    }
+
+    /// @description: Remove columns first to last (1-based, inclusive, as
+    ///               in cut -c) of every line, before any other rule sees
+    ///               the line.
+    void cut_columns(std::uint64_t first, std::uint64_t last)
+    {
+	if (!first || last < first) {
+	    return;
+	}
+	cols.emplace_back(first - 1, last);
+
+	// Keep the ranges sorted and merged.
+	std::sort(cols.begin(), cols.end());
+	std::size_t k = 0;
+	for (std::size_t i = 1; i < cols.size(); i++) {
+	    if (cols[i].first <= cols[k].second) {
+		cols[k].second = std::max(cols[k].second, cols[i].second);
+	    } else {
+		cols[++k] = cols[i];
+	    }
+	}
+	cols.resize(k + 1);
+    }
+
+    /// @description: Whether column col is removed, and the first column
+    ///               past it where that changes.
+    /// @returns: [column -> std::pair<bool, std::uint64_t>]
+    std::pair<bool, std::uint64_t> column(std::uint64_t col) const noexcept
+    {
+	for (const auto &r : cols) {
+	    if (col < r.first) {
+		return {false, r.first};
+	    }
+	    if (col < r.second) {
+		return {true, r.second};
+	    }
+	}
+
+	return {false, std::numeric_limits<std::uint64_t>::max()};
+    }
+
+    /// @description: Test whether filtering a line depends on nothing
+    ///               before it, so that input split at line starts can be
+    ///               filtered piece by piece. Removing line ends joins
+    ///               lines, so that rules that out too.
+    /// @returns: [line_local -> bool]
+    bool line_local() const noexcept
+    {
+	return !(used & F_QUOTA) && !squeeze && !(flags['\n'] & F_DROP);
+    }
+
+    /// @description: Test whether only literals with quotas can remove
+    ///               anything, so that spent quotas mean nothing will.
+    /// @returns: [quota_only -> bool]
+    bool quota_only() const noexcept
+    {
+	return !(used & ~F_QUOTA) && !squeeze && cols.empty();
+    }
+
+    void mark(unsigned char c, std::uint8_t f) noexcept
+    {
+	flags[c] |= f;
+	used |= f;
+	scan.add(c);
+    }
+};
+
+/// @description: Filter state for one input stream. The pattern stays
+///               read-only; remaining quotas, the input offset and the
+///               state of the current line live here so chunks of one
+///               stream can be fed in order.
+struct filter {
+    const pattern *pat;
+    std::array<std::int64_t, 256> quota;
+    std::uint64_t offset = 0;
+    bool line_start = true;
+    int live = 0;		// Literals with quota left.
+
+    explicit filter(const pattern &p) noexcept
+	: pat(&p), quota(p.quota)
+    {
+	for (const auto q : quota) {
+	    live += q > 0;
+	}
+    }
+
+    /// @description: Test whether nothing further can be removed: the
+    ///               pattern only has literals and their quotas are spent.
+    /// @returns: [spent -> bool]
+    bool spent() const noexcept
+    {
+	return !live && pat->quota_only();
+    }
+
+    /// @description: Decide whether the byte c is removed wherever it is,
+    ///               spending quota.
+    /// @returns: [removes -> bool]
+    bool removes(unsigned char c) noexcept
+    {
+	const auto f = pat->flags[c];
+	if (f & F_DROP) {
+	    return true;
+	}
+
+	if ((f & F_QUOTA) && quota[c] > 0) {
+	    live -= --quota[c] == 0;
+	    return true;
+	}
+
+	return false;
+    }
+
+    /// @description: Filter n bytes of src into out, in input order. Every
+    ///               removed byte is reported as on_remove(offset, byte),
+    ///               where offset counts from the start of the stream, with
+    ///               offsets always increasing. Bytes that may end a line
+    ///               (trailing candidates and a CR) are held back until the
+    ///               next byte shows what they are, and so is the start of
+    ///               an invisible character cut off by the end of src;
+    ///               nothing else is buffered, so a CR ending one chunk and
+    ///               the LF starting the next are still seen as one line end.
+    ///               Column rules apply first: each line is split once
+    ///               at its removed columns, and only the kept spans are
+    ///               filtered further.
+    template <typename OnRemove>
+    void run(const char *src, std::size_t n, std::string &out,
+	     OnRemove &&on_remove)
+    {
+	if (pat->cols.empty()) {
+	    take(src, n, out, on_remove);
+	    return;
+	}
+
+	std::size_t i = 0;
+	while (i < n) {
+	    const auto *nl = static_cast<const char *>(std::memchr(src + i, '\n', n - i));
+	    const auto body = nl ? static_cast<std::size_t>(nl - src) : n;
+
+	    while (i < body) {
+		const auto [cut, until] = pat->column(column);
+		const auto len = static_cast<std::size_t>(
+		    std::min<std::uint64_t>(until - column, body - i));
+
+		if (cut) {
+		    drop_partial(out, on_remove);
+		    for (std::size_t k = 0; k < len; k++) {
+			removed(offset + k, static_cast<unsigned char>(src[i + k]), on_remove);
+		    }
+		    offset += len;
+		} else {
+		    take(src + i, len, out, on_remove);
+		}
+		i += len;
+		column += len;
+	    }
+
+	    if (nl) {
+		take(nl, 1, out, on_remove);
+		i++;
+		column = 0;
+	    }
+	}
+    }
+
+    /// @description: Test whether filtering p[0, n) would leave it as it
+    ///               is and change no state but the offset.
+    /// @returns: [clean -> bool]
+    bool clean(const char *p, std::size_t n) const noexcept
+    {
+	return transparent() && simd::find(pat->scan, p, n) == n;
+    }
+
+    /// @description: Test whether nothing is held back waiting for what
+    ///               follows.
+    /// @returns: [settled -> bool]
+    bool settled() const noexcept
+    {
+	return held.empty() && !npartial;
+    }
+
+    /// @description: The offset before which every removal was reported;
+    ///               bytes held back or cut off may still be, later.
+    /// @returns: [reported_to -> std::uint64_t]
+    std::uint64_t reported_to() const noexcept
+    {
+	return held.empty() ? offset - npartial : held.front().offset;
+    }
+
+    /// @description: Go on filtering the stream with another pattern, its
+    ///               quotas full, from the start of a line. Only valid when
+    ///               settled() right after a line end; p has to outlive the
+    ///               filter, or the next rebind().
+    void rebind(const pattern &p) noexcept
+    {
+	pat = &p;
+	quota = p.quota;
+	live = 0;
+	for (const auto q : quota) {
+	    live += q > 0;
+	}
+	line_start = true;
+	newlines = 1;
+	column = 0;
+    }
+
+    /// @description: Test whether a block holding none of the pattern's
+    ///               bytes passes unchanged: nothing is held back waiting
+    ///               for what follows, and no rule depends on columns.
+    /// @returns: [transparent -> bool]
+    bool transparent() const noexcept
+    {
+	return settled() && pat->cols.empty();
+    }
+
+    /// @description: Account for n bytes that clean() accepted and that
+    ///               the caller passes on by itself.
+    void skip_clean(std::size_t n) noexcept
+    {
+	if (n) {
+	    offset += n;
+	    line_start = false;
+	    newlines = 0;
+	}
+    }
+
+    /// @description: How skip_zeros() handled a run of NUL bytes.
+    enum class zeros {
+	removed,		// All of them go; offset moved past them.
+	kept,			// All of them stay; offset moved past them.
+	scan,			// Not alike; the caller has to run() them.
+    };
+
+    /// @description: Account for len NUL bytes, such as a hole in a sparse
+    ///               file, without looking at them, when the pattern treats
+    ///               every one of them alike. Removed ones are not reported;
+    ///               kept ones are not appended. Both are up to the caller.
+    /// @returns: [skip_zeros -> zeros]
+    template <typename OnRemove>
+    zeros skip_zeros(std::uint64_t len, std::string &out, OnRemove &&on_remove)
+    {
+	const auto f = pat->flags[0];
+
+	if (npartial || !pat->cols.empty()) {
+	    return zeros::scan;
+	}
+
+	if ((f & F_DROP) && held.empty()) {
+	    offset += len;
+	    return zeros::removed;
+	}
+
+	if (!f) {
+	    settle(mid_line, out, on_remove);
+	    offset += len;
+	    line_start = false;
+	    newlines = 0;
+	    return zeros::kept;
+	}
+
+	return zeros::scan;
+    }
+
+    /// @description: End the stream. Trailing candidates still held back
+    ///               end the last line, so they go; a lone CR stays, and so
+    ///               does a cut-off start of an invisible character.
+    template <typename OnRemove>
+    void finish(std::string &out, OnRemove &&on_remove)
+    {
+	drop_partial(out, on_remove);
+	settle(stream_end, out, on_remove);
+    }
+
+    /// @description: run() for callers that do not track removals.
+    void run(const char *src, std::size_t n, std::string &out)
+    {
+	run(src, n, out, [](std::uint64_t, unsigned char) {});
+    }
+
+    /// @description: finish() for callers that do not track removals.
+    void finish(std::string &out)
+    {
+	finish(out, [](std::uint64_t, unsigned char) {});
+    }
+
+private:
+    enum held_kind : std::uint8_t {
+	held_removed,		// Already removed, reported in order later.
+	held_trail,		// Removed if the line ends right after it.
+	held_cr,		// Removed if a line end follows directly.
+    };
+
+    enum settle_at {
+	mid_line,
+	line_end,
+	stream_end,
+    };
+
+    struct held_byte {
+	std::uint64_t offset;
+	unsigned char c;
+	held_kind kind;
+    };
+
+    std::vector<held_byte> held;
+    bool cr_held = false;
+    int newlines = 1;		// Line ends just written; the start counts.
+    char partial[2];		// Cut-off start of an invisible character.
+    std::size_t npartial = 0;
+    std::uint64_t column = 0;	// Of the next byte in its line, 0-based.
+
+    /// @description: Filter bytes that no column rule removes.
+    template <typename OnRemove>
+    void take(const char *src, std::size_t n, std::string &out,
+	      OnRemove &on_remove)
+    {
+	// Complete the cut-off character with the first bytes of src.
+	while (npartial && n) {
+	    char seq[3];
+	    const auto len = npartial;
+	    const auto k = std::min<std::size_t>(n, sizeof(seq) - len);
+	    std::memcpy(seq, partial, len);
+	    std::memcpy(seq + len, src, k);
+	    npartial = 0;
+	    offset -= len;
+	    step(seq, len + k, out, on_remove, false);
+	    src += k;
+	    n -= k;
+	}
+
+	step(src, n, out, on_remove, false);
+    }
+
+    /// @description: Give up on completing a cut-off invisible character,
+    ///               at the end of the stream or of a kept span: its bytes
+    ///               are filtered as they are.
+    template <typename OnRemove>
+    void drop_partial(std::string &out, OnRemove &on_remove)
+    {
+	if (npartial) {
+	    char seq[sizeof(partial)];
+	    const auto len = npartial;
+	    std::memcpy(seq, partial, len);
+	    npartial = 0;
+	    offset -= len;
+	    step(seq, len, out, on_remove, true);
+	}
+    }
+
+    /// @description: Report the removal of c at off, in offset order
+    ///               behind whatever is held back.
+    template <typename OnRemove>
+    void removed(std::uint64_t off, unsigned char c, OnRemove &on_remove)
+    {
+	if (held.empty()) {
+	    on_remove(off, c);
+	} else {
+	    held.push_back({off, c, held_removed});
+	}
+    }
+
+    /// @description: run() on one piece of input; at the end of the stream
+    ///               (last), a cut-off invisible character is just bytes.
+    template <typename OnRemove>
+    void step(const char *src, std::size_t n, std::string &out,
+	      OnRemove &on_remove, bool last)
+    {
+	const auto &flags = pat->flags;
+	std::size_t i = 0;
+
+	while (i < n) {
+	    // Copy the run of bytes the pattern never touches in one go.
+	    const auto j = i + simd::find(pat->scan, src + i, n - i);
+	    if (j != i) {
+		settle(mid_line, out, on_remove);
+		out.append(src + i, j - i);
+		line_start = false;
+		newlines = 0;
+	    }
+	    if (j == n) {
+		break;
+	    }
+
+	    const auto c = static_cast<unsigned char>(src[j]);
+	    const auto f = flags[c];
+	    const auto off = offset + j;
+	    i = j + 1;
+
+	    if (f & F_INVIS) {
+		const auto r = utf8::invisible(
+		    reinterpret_cast<const unsigned char *>(src + j), n - j);
+		if (r == utf8::INCOMPLETE && !last) {
+		    npartial = n - j;
+		    std::memcpy(partial, src + j, npartial);
+		    break;
+		}
+		if (r > 0) {
+		    for (int k = 0; k < r; k++) {
+			removed(off + k, static_cast<unsigned char>(src[j + k]), on_remove);
+		    }
+		    i = j + r;
+		    continue;
+		}
+	    }
+
+	    if (removes(c) || (line_start && (f & F_LEAD))) {
+		removed(off, c, on_remove);
+
+		// The last quota went: the rest only needs copying.
+		if (spent()) {
+		    out.append(src + i, n - i);
+		    break;
+		}
+		continue;
+	    }
+
+	    if (f & F_TRAIL) {
+		// A blank run followed by a plain byte is not trailing:
+		// keep it without holding it back byte by byte.
+		if (held.empty() && !(f & F_QUOTA)) {
+		    auto k = i;
+		    while (k < n && flags[static_cast<unsigned char>(src[k])] == f) {
+			k++;
+		    }
+		    if (k < n && !flags[static_cast<unsigned char>(src[k])]) {
+			out.append(src + j, k - j);
+			line_start = false;
+			newlines = 0;
+			i = k;
+			continue;
+		    }
+		}
+
+		// Whatever was held before a CR is not trailing any more.
+		if (cr_held) {
+		    settle(mid_line, out, on_remove);
+		}
+		held.push_back({off, c, held_trail});
+		line_start = false;
+		continue;
+	    }
+
+	    if (f & F_CR) {
+		if (cr_held) {
+		    settle(mid_line, out, on_remove);
+		}
+		held.push_back({off, c, held_cr});
+		cr_held = true;
+		line_start = false;
+		continue;
+	    }
+
+	    if (!(f & F_EOL)) {
+		settle(mid_line, out, on_remove);
+		out.push_back(static_cast<char>(c));
+		line_start = false;
+		newlines = 0;
+		continue;
+	    }
+
+	    settle(line_end, out, on_remove);
+	    line_start = true;
+	    if (pat->squeeze && newlines >= 2) {
+		on_remove(off, c);
+		continue;
+	    }
+	    out.push_back(static_cast<char>(c));
+	    newlines++;
+	}
+
+	offset += n;
+    }
+
+    /// @description: Resolve the held-back bytes once it is known whether
+    ///               the line ends after them.
+    template <typename OnRemove>
+    void settle(settle_at at, std::string &out, OnRemove &on_remove)
+    {
+	// A CR left at the very end is content, so nothing before it trails.
+	if (at == stream_end && cr_held) {
+	    at = mid_line;
+	}
+
+	for (const auto &h : held) {
+	    const bool gone = h.kind == held_removed ||
+		(h.kind == held_trail && at != mid_line) ||
+		(h.kind == held_cr && at == line_end);
+
+	    if (gone) {
+		on_remove(h.offset, h.c);
+	    } else {
+		out.push_back(static_cast<char>(h.c));
+		newlines = 0;
+	    }
+	}
+	held.clear();
+	cr_held = false;
+    }
+};
+
+} // namespace
+
+#endif
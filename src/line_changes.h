@@ -0,0 +1,126 @@
+// Line numbers of the lines a filter run modified, found in the same pass.
+
+#ifndef LINE_CHANGES_H
+# define LINE_CHANGES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "simd.h"
+
+namespace line_changes {
+
+/// @description: Turns the removals of a filter run into the numbers of
+///               the lines they were on, counted from 1, written to buf as
+///               "N\n", or "N\tREMOVED\n" with counts. The input is shown
+///               a block at a time, after it was run: between two removals
+///               the line ends of the block are only counted, and just the
+///               ones the filter may still report a removal before are
+///               kept, which normally is none.
+struct tracker {
+    bool counts = false;
+    std::string buf;
+
+    /// @description: The byte at off (and the n - 1 after it) was removed.
+    void removed(std::uint64_t off, std::uint64_t n = 1)
+    {
+	if (!pending.empty() && pending.back().first == off) {
+	    pending.back().second += n;
+	} else {
+	    pending.emplace_back(off, n);
+	}
+    }
+
+    /// @description: Account for the next n input bytes p[0, n), run
+    ///               through the filter already; removals before `settled`
+    ///               were all reported. p is nullptr for a run of NULs.
+    void block(const char *p, std::size_t n, std::uint64_t settled)
+    {
+	const auto end = base + n;
+	for (const auto &[off, k] : pending) {
+	    advance(p, off);
+	    hits += k;
+	}
+	pending.clear();
+
+	// Keep the line ends a late removal might come before.
+	advance(p, std::min(settled, end));
+	for (auto at = std::max(cursor, base); p && at < end; at++) {
+	    const auto *nl = static_cast<const char *>(
+		std::memchr(p + (at - base), '\n', end - at));
+	    if (!nl) {
+		break;
+	    }
+	    at = base + static_cast<std::uint64_t>(nl - p);
+	    kept.push_back(at);
+	}
+	base = end;
+    }
+
+    /// @description: The input ended: report the last line.
+    void finish()
+    {
+	for (const auto &[off, k] : pending) {
+	    advance(nullptr, off);
+	    hits += k;
+	}
+	pending.clear();
+	close_line();
+    }
+
+private:
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> pending;
+    std::deque<std::uint64_t> kept;	// Line ends in [cursor, base).
+    std::uint64_t base = 0;		// Offset of the block being shown.
+    std::uint64_t cursor = 0;		// Line ends before it are counted.
+    std::uint64_t line = 1;
+    std::uint64_t hits = 0;		// Removals on the line so far.
+
+    /// @description: Count the line ends before off, from the kept ones
+    ///               and then from the block p, which starts at base.
+    void advance(const char *p, std::uint64_t off)
+    {
+	while (!kept.empty() && kept.front() < off) {
+	    kept.pop_front();
+	    next_lines(1);
+	}
+
+	const auto from = std::max(cursor, base);
+	if (p && off > from) {
+	    next_lines(simd::count(p + (from - base), off - from, '\n'));
+	}
+	cursor = std::max(cursor, off);
+    }
+
+    void next_lines(std::uint64_t k)
+    {
+	if (k) {
+	    close_line();
+	    line += k;
+	}
+    }
+
+    void close_line()
+    {
+	if (!hits) {
+	    return;
+	}
+
+	buf.append(std::to_string(line));
+	if (counts) {
+	    buf.push_back('\t');
+	    buf.append(std::to_string(hits));
+	}
+	buf.push_back('\n');
+	hits = 0;
+    }
+};
+
+} // namespace
+
+#endif
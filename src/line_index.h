@@ -0,0 +1,189 @@
+// Sparse index of line starts, kept next to a file as FILE.xci.
+//
+// Layout:
+//   "XCIX" 0x01
+//   u64le(file size) u64le(mtime seconds) u64le(mtime nanoseconds)
+//   varint(lines) varint(every) varint(count) varint(delta)*
+//
+// Entry k is the offset at which line k * every starts (lines counted from
+// 0), stored as a delta against the entry before it. `lines` counts every
+// line, a last one without a line end included. An index is only trusted
+// while its file keeps the size and mtime recorded in it.
+
+#ifndef LINE_INDEX_H
+# define LINE_INDEX_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "sidecar.h"
+#include "simd.h"
+
+namespace line_index {
+
+inline constexpr std::string_view magic = "XCIX\x01";
+inline constexpr std::uint64_t default_every = 4096;
+
+/// @description: The decoded index of one file.
+struct index {
+    std::uint64_t size = 0;
+    std::uint64_t mtime_sec = 0, mtime_nsec = 0;
+    std::uint64_t lines = 0;
+    std::uint64_t every = default_every;
+    std::vector<std::uint64_t> starts;	// Of lines 0, every, 2 * every...
+
+    /// @description: Test whether the index still describes a file of
+    ///               this size and modification time.
+    /// @returns: [matches -> bool]
+    bool matches(std::uint64_t sz, std::uint64_t sec, std::uint64_t nsec) const noexcept
+    {
+	return size == sz && mtime_sec == sec && mtime_nsec == nsec;
+    }
+
+    /// @description: Serialize the index.
+    /// @returns: [encode -> std::string]
+    std::string encode() const
+    {
+	std::string out {magic};
+	for (const auto v : {size, mtime_sec, mtime_nsec}) {
+	    for (int i = 0; i < 8; i++) {
+		out.push_back(static_cast<char>(v >> (8 * i)));
+	    }
+	}
+
+	sidecar::put_varint(out, lines);
+	sidecar::put_varint(out, every);
+	sidecar::put_varint(out, starts.size());
+	std::uint64_t prev = 0;
+	for (const auto s : starts) {
+	    sidecar::put_varint(out, s - prev);
+	    prev = s;
+	}
+
+	return out;
+    }
+
+    /// @description: Parse an encoded index.
+    /// @returns: [decode -> bool], false if it is malformed.
+    bool decode(std::string_view in)
+    {
+	if (in.substr(0, magic.size()) != magic || in.size() < magic.size() + 24) {
+	    return false;
+	}
+	in.remove_prefix(magic.size());
+
+	for (auto *v : {&size, &mtime_sec, &mtime_nsec}) {
+	    *v = 0;
+	    for (int i = 0; i < 8; i++) {
+		*v |= static_cast<std::uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+	    }
+	    in.remove_prefix(8);
+	}
+
+	auto varint = [&in](std::uint64_t &v) {
+	    v = 0;
+	    for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+		const auto c = static_cast<unsigned char>(in.front());
+		in.remove_prefix(1);
+		v |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+		    return true;
+		}
+	    }
+	    return false;
+	};
+
+	// A built index always holds the start of line 0.
+	std::uint64_t count;
+	if (!varint(lines) || !varint(every) || !every || !varint(count) ||
+	    !count || count > in.size()) {
+	    return false;
+	}
+
+	starts.clear();
+	starts.reserve(count);
+	for (std::uint64_t prev = 0, d; count--; ) {
+	    if (!varint(d)) {
+		return false;
+	    }
+	    prev += d;
+	    starts.push_back(prev);
+	}
+
+	return true;
+    }
+};
+
+/// @description: Build an index from the file content, fed in order.
+///               Newlines are counted a chunk at a time, and only a chunk
+///               holding the start of a sampled line is searched for it.
+struct builder {
+    index idx;
+
+    builder()
+    {
+	idx.starts.push_back(0);
+    }
+
+    /// @description: Account for the next n bytes of the file.
+    void feed(const char *p, std::size_t n)
+    {
+	const auto end = p + n;
+	const auto base = offset;
+	offset += n;
+	if (n) {
+	    last = p[n - 1];
+	}
+
+	auto next = idx.starts.size() * idx.every;	// Next sampled line.
+	auto left = simd::count(p, n, '\n');
+	if (idx.lines + left < next) {
+	    idx.lines += left;
+	    return;
+	}
+
+	for (const char *q = p; left; q++) {
+	    q = static_cast<const char *>(std::memchr(q, '\n', end - q));
+	    idx.lines++;
+	    left--;
+	    if (idx.lines == next) {
+		idx.starts.push_back(base + static_cast<std::uint64_t>(q + 1 - p));
+		next += idx.every;
+		if (idx.lines + left < next) {
+		    idx.lines += left;
+		    break;
+		}
+	    }
+	}
+    }
+
+    /// @description: Complete the index of a file of this modification
+    ///               time.
+    /// @returns: [finish -> index &]
+    index &finish(std::uint64_t sec, std::uint64_t nsec)
+    {
+	idx.size = offset;
+	idx.mtime_sec = sec;
+	idx.mtime_nsec = nsec;
+	if (offset && last != '\n') {
+	    idx.lines++;
+	}
+	// A sample at the very end starts no line.
+	if (idx.starts.size() > 1 && idx.starts.back() == offset) {
+	    idx.starts.pop_back();
+	}
+
+	return idx;
+    }
+
+private:
+    std::uint64_t offset = 0;
+    char last = '\n';
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,146 @@
+// Filtering one buffer on several threads, without owning any of them.
+
+#ifndef PARALLEL_H
+# define PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "filter.h"
+
+namespace xc {
+
+/// @description: Runs a task somewhere, e.g. by posting it to the caller's
+///               thread pool. It may run the task at once, later, or on the
+///               submitting thread.
+using executor = std::function<void(std::function<void()>)>;
+
+/// @description: Split in[0, n) into pieces of about `piece` bytes, each
+///               ending just after a line end, or at the end of the input.
+/// @returns: [split_lines -> std::vector<std::size_t>], piece k being
+///           [bounds[k], bounds[k + 1]).
+inline std::vector<std::size_t> split_lines(std::string_view in, std::size_t piece)
+{
+    std::vector<std::size_t> bounds {0};
+    for (std::size_t at = 0; at < in.size();) {
+	auto end = in.size();
+	if (in.size() - at > piece) {
+	    const auto *nl = static_cast<const char *>(
+		std::memchr(in.data() + at + piece, '\n', in.size() - at - piece));
+	    if (nl) {
+		end = static_cast<std::size_t>(nl - in.data()) + 1;
+	    }
+	}
+	bounds.push_back(end);
+	at = end;
+    }
+
+    return bounds;
+}
+
+/// @description: Filter `in` as a whole stream, in pieces split at line
+///               starts, handing up to tasks - 1 helper tasks to `submit`
+///               while the calling thread filters pieces as well. Output
+///               goes to emit(std::string_view) piece by piece in input
+///               order, from the calling thread, which returns once all of
+///               it was emitted; a helper that starts after that finds
+///               nothing left to do and returns at once. A pattern that is
+///               not line_local() is filtered by the calling thread alone.
+template <typename Emit>
+void filter_parallel(const pattern &pat, std::string_view in,
+		     const executor &submit, unsigned tasks, Emit &&emit,
+		     std::size_t piece = 1024 * 1024)
+{
+    if (!pat.line_local() || tasks < 2 || in.size() <= piece) {
+	std::string out;
+	out.reserve(in.size());
+	filter flt {pat};
+	flt.run(in.data(), in.size(), out);
+	flt.finish(out);
+	emit(std::string_view(out));
+	return;
+    }
+
+    // Shared with the helpers, which may outlive this call.
+    struct work {
+	const pattern *pat;
+	std::string_view in;
+	std::vector<std::size_t> bounds;
+	std::vector<std::string> outs;
+	std::vector<char> done;
+	std::atomic<std::size_t> next {0};
+	std::mutex lock;
+	std::condition_variable finished;
+
+	/// @description: Filter the next unclaimed piece.
+	/// @returns: [step -> bool], false once none is left.
+	bool step()
+	{
+	    const auto k = next++;
+	    if (k >= outs.size()) {
+		return false;
+	    }
+
+	    const auto from = bounds[k], len = bounds[k + 1] - from;
+	    std::string out;
+	    out.reserve(len);
+	    filter flt {*pat};
+	    flt.run(in.data() + from, len, out);
+	    flt.finish(out);
+
+	    std::lock_guard<std::mutex> g {lock};
+	    outs[k].swap(out);
+	    done[k] = 1;
+	    finished.notify_all();
+	    return true;
+	}
+    };
+
+    auto w = std::make_shared<work>();
+    w->pat = &pat;
+    w->in = in;
+    w->bounds = split_lines(in, piece);
+    w->outs.resize(w->bounds.size() - 1);
+    w->done.resize(w->outs.size());
+
+    for (unsigned i = 1; i < tasks && i < w->outs.size(); i++) {
+	submit([w] {
+	    while (w->step()) {
+	    }
+	});
+    }
+
+    std::size_t emitted = 0;
+    auto emit_ready = [&](bool wait) {
+	while (emitted < w->outs.size()) {
+	    std::string out;
+	    {
+		std::unique_lock<std::mutex> g {w->lock};
+		if (wait) {
+		    w->finished.wait(g, [&] { return w->done[emitted] != 0; });
+		} else if (!w->done[emitted]) {
+		    return;
+		}
+		out.swap(w->outs[emitted]);
+	    }
+	    emit(std::string_view(out));
+	    emitted++;
+	}
+    };
+
+    while (w->step()) {
+	emit_ready(false);
+    }
+    emit_ready(true);
+}
+
+} // namespace
+
+#endif
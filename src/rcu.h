@@ -0,0 +1,121 @@
+// Replacing a shared, read-only value under readers that never lock.
+
+#ifndef RCU_H
+# define RCU_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace rcu {
+
+/// @description: Holds the current version of an immutable T. A reader
+///               announces the version it uses in its own slot, with two
+///               atomic loads and a store, and keeps using it for as long
+///               as it likes; publish() swaps in a new version and frees
+///               an old one only once no slot announces it any more. Only
+///               writers serialize, among themselves.
+template <typename T, std::size_t Readers = 8>
+class cell {
+public:
+    explicit cell(std::unique_ptr<const T> first) noexcept
+	: cur(first.release())
+    {
+	for (auto &h : hazard) {
+	    h.store(nullptr);
+	}
+    }
+
+    cell(const cell &) = delete;
+    cell &operator=(const cell &) = delete;
+
+    ~cell()
+    {
+	delete cur.load();
+	for (const auto *p : retired) {
+	    delete p;
+	}
+    }
+
+    /// @description: One reader, owning slot `slot` (< Readers), which no
+    ///               other live reader may share.
+    class reader {
+    public:
+	reader(cell &c, std::size_t slot) noexcept
+	    : c(&c), h(&c.hazard[slot])
+	{
+	}
+
+	reader(const reader &) = delete;
+	reader &operator=(const reader &) = delete;
+
+	~reader()
+	{
+	    h->store(nullptr);
+	}
+
+	/// @description: Take the current version. It stays valid until the
+	///               next get(), which releases it, or the reader's end.
+	/// @returns: [get -> const T *]
+	const T *get() noexcept
+	{
+	    auto *p = c->cur.load();
+	    for (;;) {
+		h->store(p);
+		// Announced before the writer looked, or it is not current.
+		auto *q = c->cur.load();
+		if (q == p) {
+		    return p;
+		}
+		p = q;
+	    }
+	}
+
+	/// @description: Test whether a version newer than `held`, the one
+	///               last taken, was published.
+	/// @returns: [stale -> bool]
+	bool stale(const T *held) const noexcept
+	{
+	    return c->cur.load(std::memory_order_relaxed) != held;
+	}
+
+    private:
+	cell *c;
+	std::atomic<const T *> *h;
+    };
+
+    /// @description: Make next the current version, and free the ones that
+    ///               were replaced and that no reader holds.
+    void publish(std::unique_ptr<const T> next)
+    {
+	std::lock_guard<std::mutex> g {lock};
+	retired.push_back(cur.exchange(next.release()));
+
+	std::size_t kept = 0;
+	for (const auto *p : retired) {
+	    bool held = false;
+	    for (const auto &h : hazard) {
+		held |= h.load() == p;
+	    }
+	    if (held) {
+		retired[kept++] = p;
+	    } else {
+		delete p;
+	    }
+	}
+	retired.resize(kept);
+    }
+
+private:
+    std::atomic<const T *> cur;
+    std::array<std::atomic<const T *>, Readers> hazard;
+    std::mutex lock;			// Of the writers.
+    std::vector<const T *> retired;
+};
+
+} // namespace
+
+#endif
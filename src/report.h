@@ -0,0 +1,177 @@
+// Per-file reports of a batch run, as JSON lines written off the hot path.
+
+#ifndef REPORT_H
+# define REPORT_H
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "char_type.h"
+
+namespace report {
+
+/// @description: What happened to one file.
+struct file_record {
+    std::string path;
+    std::string out;			// Empty when it was skipped.
+    std::string_view engine;		// "stream", "copy" or "skip".
+    bool binary = false;
+    std::uint64_t bytes_in = 0;
+    std::uint64_t bytes_out = 0;
+    std::array<std::uint64_t, 256> removed {};	// Per byte value.
+    std::uint64_t wall_ns = 0;
+    std::uint64_t cpu_ns = 0;
+};
+
+/// @description: The classes removals are summed into, each byte counting
+///               in the first one that matches it.
+inline constexpr std::string_view classes[] = {
+    "space", "cntrl", "digit", "alpha", "punct", "nonascii",
+};
+
+/// @description: The class of byte c, as an index into classes.
+/// @returns: [class_of -> std::size_t]
+constexpr inline std::size_t class_of(int c) noexcept
+{
+    return char_type::isaspace(c) ? 0 : char_type::iscntrl(c) ? 1 :
+	char_type::isdigit(c) ? 2 : char_type::isalpha(c) ? 3 :
+	char_type::ispunct(c) ? 4 : 5;
+}
+
+/// @description: Append s as a JSON string.
+inline void put_string(std::string &out, std::string_view s)
+{
+    out.push_back('"');
+    for (const auto ch : s) {
+	const auto c = static_cast<unsigned char>(ch);
+	if (c == '"' || c == '\\') {
+	    out.push_back('\\');
+	    out.push_back(ch);
+	} else if (c < 0x20) {
+	    char esc[8];
+	    std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+	    out.append(esc);
+	} else {
+	    out.push_back(ch);
+	}
+    }
+    out.push_back('"');
+}
+
+/// @description: Format r as one JSON object and a line end.
+/// @returns: [json -> std::string]
+inline std::string json(const file_record &r)
+{
+    std::array<std::uint64_t, std::size(classes)> sums {};
+    std::uint64_t total = 0;
+    for (int c = 0; c < 256; c++) {
+	sums[class_of(c)] += r.removed[c];
+	total += r.removed[c];
+    }
+
+    std::string out {"{\"file\":"};
+    put_string(out, r.path);
+    out.append(",\"out\":");
+    if (r.out.empty()) {
+	out.append("null");
+    } else {
+	put_string(out, r.out);
+    }
+    out.append(",\"engine\":");
+    put_string(out, r.engine);
+    out.append(",\"binary\":").append(r.binary ? "true" : "false");
+    out.append(",\"bytes_in\":").append(std::to_string(r.bytes_in));
+    out.append(",\"bytes_out\":").append(std::to_string(r.bytes_out));
+    out.append(",\"removed\":{\"total\":").append(std::to_string(total));
+    for (std::size_t k = 0; k < sums.size(); k++) {
+	if (sums[k]) {
+	    out.append(",");
+	    put_string(out, classes[k]);
+	    out.append(":").append(std::to_string(sums[k]));
+	}
+    }
+    out.append("},\"unchanged\":");
+    out.append(!r.out.empty() && !total ? "true" : "false");
+    out.append(",\"wall_ns\":").append(std::to_string(r.wall_ns));
+    out.append(",\"cpu_ns\":").append(std::to_string(r.cpu_ns));
+    out.append("}\n");
+
+    return out;
+}
+
+/// @description: Formats and writes records on a thread of its own, so a
+///               worker only queues them. Records come out in the order
+///               they were pushed, the last ones once the writer ends.
+class writer {
+public:
+    explicit writer(std::function<void(std::string_view)> write)
+	: write(std::move(write)), thread([this] { loop(); })
+    {
+    }
+
+    writer(const writer &) = delete;
+    writer &operator=(const writer &) = delete;
+
+    ~writer()
+    {
+	{
+	    std::lock_guard<std::mutex> g {lock};
+	    closed = true;
+	}
+	ready.notify_one();
+	thread.join();
+    }
+
+    /// @description: Queue r for writing.
+    void push(file_record r)
+    {
+	{
+	    std::lock_guard<std::mutex> g {lock};
+	    queue.push_back(std::move(r));
+	}
+	ready.notify_one();
+    }
+
+private:
+    std::function<void(std::string_view)> write;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<file_record> queue;
+    bool closed = false;
+    std::thread thread;		// Last: it starts once the rest is set up.
+
+    void loop()
+    {
+	for (;;) {
+	    std::deque<file_record> batch;
+	    {
+		std::unique_lock<std::mutex> g {lock};
+		ready.wait(g, [this] { return closed || !queue.empty(); });
+		if (queue.empty()) {
+		    return;
+		}
+		batch.swap(queue);
+	    }
+
+	    std::string lines;
+	    for (const auto &r : batch) {
+		lines.append(json(r));
+	    }
+	    write(lines);
+	}
+    }
+};
+
+} // namespace
+
+#endif
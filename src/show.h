@@ -0,0 +1,92 @@
+// Showing selected bytes in printable notation instead of removing them.
+
+#ifndef SHOW_H
+# define SHOW_H
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "simd.h"
+
+namespace show {
+
+/// @description: How a shown byte is written.
+enum class notation {
+    caret,			// ^X, ^? and M- for the high half, as cat -v.
+    hex,			// \xNN.
+};
+
+/// @description: The longest escape either notation writes, "M-^X".
+inline constexpr std::size_t max_escape = 4;
+
+/// @description: The bytes to show and their precomputed escapes.
+struct table {
+    simd::byteset set;
+    std::array<std::array<char, max_escape>, 256> esc {};
+    std::array<std::uint8_t, 256> len {};
+
+    explicit table(notation how) noexcept : how(how) {}
+
+    /// @description: Show c escaped. A line end always stays as it is.
+    void add(unsigned char c) noexcept
+    {
+	if (c == '\n' || len[c]) {
+	    return;
+	}
+
+	auto &e = esc[c];
+	std::size_t n = 0;
+	if (how == notation::hex) {
+	    char buf[5];
+	    std::snprintf(buf, sizeof(buf), "\\x%02x", c);
+	    for (; n < 4; n++) {
+		e[n] = buf[n];
+	    }
+	} else {
+	    auto low = c;
+	    if (c >= 0x80) {
+		e[n++] = 'M';
+		e[n++] = '-';
+		low = static_cast<unsigned char>(c - 0x80);
+	    }
+	    if (low < 0x20 || low == 0x7f) {
+		e[n++] = '^';
+		e[n++] = static_cast<char>(low ^ 0x40);
+	    } else {
+		e[n++] = static_cast<char>(low);
+	    }
+	}
+
+	len[c] = static_cast<std::uint8_t>(n);
+	set.add(c);
+    }
+
+private:
+    notation how;
+};
+
+/// @description: Append p[0, n) to out with every byte of the table
+///               escaped. Runs without any are appended whole, and out
+///               grows at most once, to the worst case, up front.
+inline void expand(const table &t, const char *p, std::size_t n, std::string &out)
+{
+    out.reserve(out.size() + n * max_escape);
+
+    for (std::size_t i = 0; i < n;) {
+	const auto j = i + simd::find(t.set, p + i, n - i);
+	out.append(p + i, j - i);
+	if (j == n) {
+	    break;
+	}
+
+	const auto c = static_cast<unsigned char>(p[j]);
+	out.append(t.esc[c].data(), t.len[c]);
+	i = j + 1;
+    }
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,242 @@
+// Sidecar encoding of the bytes a filter run removed.
+//
+// Layout:
+//   "XCSC" 0x01
+//   record*        varint(len << 1 | uniform) varint(gap) byte{uniform ? 1 : len}
+//   0x00           end of records
+//   index          varint(count) {varint(d_in) varint(d_out) varint(d_pos)}*
+//   footer         u64le(index position) "XCSI"
+//
+// `gap` is the number of kept bytes between the previous run and this one,
+// so the output offset of a run is its input offset minus everything removed
+// before it. A uniform run stores its byte once. Every index_every runs the
+// index remembers (input offset, output offset, record position), deltas
+// against the previous entry, which lets a reader map an output offset back
+// to the input by seeking close to it instead of decoding from the start.
+
+#ifndef SIDECAR_H
+# define SIDECAR_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+
+namespace sidecar {
+
+inline constexpr std::string_view magic = "XCSC\x01";
+inline constexpr std::string_view footer_magic = "XCSI";
+inline constexpr std::size_t index_every = 1024;
+inline constexpr std::size_t max_run = 64 * 1024;
+
+/// @description: Append v to out as an LEB128 varint.
+inline void put_varint(std::string &out, std::uint64_t v)
+{
+    while (v >= 0x80) {
+	out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+	v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+/// @description: Encoder for removed bytes, fed in input order. Encoded
+///               bytes collect in buf; the caller writes them out and
+///               clears buf whenever it likes.
+struct writer {
+    struct checkpoint {
+	std::uint64_t in, out, pos;
+    };
+
+    std::string buf {magic};
+    std::uint64_t pos = magic.size();	// Bytes encoded so far, flushed or not.
+
+    /// @description: Record that the byte c at input offset off was removed.
+    void remove(std::uint64_t off, unsigned char c)
+    {
+	if (run_len && off == run_off + run_len) {
+	    if (uniform && c == run_byte) {
+		run_len++;
+		return;
+	    }
+
+	    // Mixed runs keep their bytes, so cap them to bound memory.
+	    if (run_len < max_run) {
+		if (uniform) {
+		    run.assign(run_len, static_cast<char>(run_byte));
+		    uniform = false;
+		}
+		run.push_back(static_cast<char>(c));
+		run_len++;
+		return;
+	    }
+	}
+
+	emit();
+	run_off = off;
+	run_len = 1;
+	run_byte = c;
+	uniform = true;
+    }
+
+    /// @description: Record that len copies of c starting at input offset
+    ///               off were removed, in constant time.
+    void remove_run(std::uint64_t off, unsigned char c, std::uint64_t len)
+    {
+	if (!len) {
+	    return;
+	}
+
+	if (!(run_len && uniform && run_byte == c && off == run_off + run_len)) {
+	    emit();
+	    run_off = off;
+	    run_byte = c;
+	    uniform = true;
+	}
+	run_len += len;
+    }
+
+    /// @description: Flush the pending run and append the terminator,
+    ///               the index and the footer.
+    void finish()
+    {
+	emit();
+	buf.push_back('\0');
+	pos++;
+
+	const auto index_pos = pos;
+	const auto start = buf.size();
+	checkpoint prev {0, 0, 0};
+	put_varint(buf, index.size());
+	for (const auto &cp : index) {
+	    put_varint(buf, cp.in - prev.in);
+	    put_varint(buf, cp.out - prev.out);
+	    put_varint(buf, cp.pos - prev.pos);
+	    prev = cp;
+	}
+	for (int i = 0; i < 8; i++) {
+	    buf.push_back(static_cast<char>(index_pos >> (8 * i)));
+	}
+	buf.append(footer_magic);
+	pos += buf.size() - start;
+    }
+
+private:
+    std::uint64_t run_off = 0, run_len = 0;
+    std::uint64_t prev_end = 0, removed = 0, runs = 0;
+    unsigned char run_byte = 0;
+    bool uniform = true;
+    std::string run;
+    std::vector<checkpoint> index;
+
+    void emit()
+    {
+	if (!run_len) {
+	    return;
+	}
+
+	if (runs++ % index_every == 0) {
+	    index.push_back({run_off, run_off - removed, pos});
+	}
+
+	const auto start = buf.size();
+	put_varint(buf, (run_len << 1) | (uniform ? 1 : 0));
+	put_varint(buf, run_off - prev_end);
+	if (uniform) {
+	    buf.push_back(static_cast<char>(run_byte));
+	} else {
+	    buf.append(run);
+	}
+	pos += buf.size() - start;
+
+	prev_end = run_off + run_len;
+	removed += run_len;
+	run_len = 0;
+	run.clear();
+    }
+};
+
+/// @description: Buffered sequential decoder reading a sidecar from fd.
+struct reader {
+    explicit reader(int fd) noexcept : fd(fd) {}
+
+    /// @description: Read one byte.
+    /// @returns: [get -> bool], false on end of file or read error.
+    bool get(unsigned char &c)
+    {
+	if (at == len && !refill()) {
+	    return false;
+	}
+	c = static_cast<unsigned char>(buf[at++]);
+	return true;
+    }
+
+    /// @description: Read one LEB128 varint.
+    /// @returns: [varint -> bool], false if truncated or overlong.
+    bool varint(std::uint64_t &v)
+    {
+	unsigned char c;
+	v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+	    if (!get(c)) {
+		return false;
+	    }
+	    v |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+	    if (!(c & 0x80)) {
+		return true;
+	    }
+	}
+
+	return false;
+    }
+
+    /// @description: Hand out up to want buffered bytes without copying.
+    /// @returns: [bytes -> std::string_view], empty on end of file.
+    std::string_view bytes(std::size_t want)
+    {
+	if (at == len && !refill()) {
+	    return {};
+	}
+	const auto n = std::min(want, len - at);
+	std::string_view sv {buf + at, n};
+	at += n;
+	return sv;
+    }
+
+    /// @description: Check the leading magic.
+    /// @returns: [header -> bool]
+    bool header()
+    {
+	for (const auto m : magic) {
+	    unsigned char c;
+	    if (!get(c) || c != static_cast<unsigned char>(m)) {
+		return false;
+	    }
+	}
+
+	return true;
+    }
+
+private:
+    int fd;
+    char buf[64 * 1024];
+    std::size_t at = 0, len = 0;
+
+    bool refill()
+    {
+	ssize_t n;
+	do {
+	    n = read(fd, buf, sizeof(buf));
+	} while (n == -1 && errno == EINTR);
+
+	at = 0;
+	len = n > 0 ? static_cast<std::size_t>(n) : 0;
+	return len != 0;
+    }
+};
+
+} // namespace
+
+#endif
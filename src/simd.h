@@ -0,0 +1,159 @@
+// Vectorized search for the first byte belonging to a byte set.
+
+#ifndef SIMD_H
+# define SIMD_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+# include <tmmintrin.h>
+#endif
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+namespace simd {
+
+/// @description: A set of byte values, kept both as a plain table for the
+///               scalar path and as two nibble bitmaps for the pshufb path:
+///               byte b is in the set when bit (b >> 4) of row (b & 15) is
+///               set, rows for the high nibbles 0-7 and 8-15 apart.
+struct byteset {
+    std::array<std::uint8_t, 256> table {};
+    alignas(16) std::uint8_t rows_lo[16] {};
+    alignas(16) std::uint8_t rows_hi[16] {};
+
+    void add(unsigned char b) noexcept
+    {
+	table[b] = 1;
+	if (b < 0x80) {
+	    rows_lo[b & 15] |= static_cast<std::uint8_t>(1 << (b >> 4));
+	} else {
+	    rows_hi[b & 15] |= static_cast<std::uint8_t>(1 << ((b >> 4) - 8));
+	}
+    }
+};
+
+/// @description: Scalar fallback for find().
+/// @returns: [find_scalar -> std::size_t]
+inline std::size_t find_scalar(const byteset &set, const char *p,
+			       std::size_t n) noexcept
+{
+    for (std::size_t i = 0; i < n; i++) {
+	if (set.table[static_cast<unsigned char>(p[i])]) {
+	    return i;
+	}
+    }
+
+    return n;
+}
+
+#if defined(__x86_64__)
+/// @description: Mask of the bytes of v that are in the set.
+/// @returns: [match_ssse3 -> int], bit i set when byte i matches.
+__attribute__((target("ssse3")))
+inline int match_ssse3(const byteset &set, __m128i v) noexcept
+{
+    const auto rows_lo = _mm_load_si128(reinterpret_cast<const __m128i *>(set.rows_lo));
+    const auto rows_hi = _mm_load_si128(reinterpret_cast<const __m128i *>(set.rows_hi));
+    const auto bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+				    1, 2, 4, 8, 16, 32, 64, -128);
+    const auto nib = _mm_set1_epi8(0x0f);
+
+    const auto lo = _mm_and_si128(v, nib);
+    const auto hi = _mm_and_si128(_mm_srli_epi16(v, 4), nib);
+
+    const auto upper = _mm_cmpgt_epi8(hi, _mm_set1_epi8(7));
+    const auto row = _mm_or_si128(
+	_mm_and_si128(upper, _mm_shuffle_epi8(rows_hi, lo)),
+	_mm_andnot_si128(upper, _mm_shuffle_epi8(rows_lo, lo)));
+    const auto hit = _mm_and_si128(row, _mm_shuffle_epi8(bits, hi));
+
+    return ~_mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128())) & 0xffff;
+}
+
+/// @description: find() on 16-byte blocks with pshufb lookups.
+/// @returns: [find_ssse3 -> std::size_t]
+__attribute__((target("ssse3")))
+inline std::size_t find_ssse3(const byteset &set, const char *p,
+			      std::size_t n) noexcept
+{
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+	const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+	if (const auto m = match_ssse3(set, v)) {
+	    return i + __builtin_ctz(m);
+	}
+    }
+
+    return i + find_scalar(set, p + i, n - i);
+}
+#endif
+
+/// @description: Find the first byte of p[0, n) that is in the set.
+/// @returns: [find -> std::size_t], n if there is none.
+inline std::size_t find(const byteset &set, const char *p, std::size_t n) noexcept
+{
+    // Dense sets stop within a few bytes; try those before going wide.
+    const auto head = find_scalar(set, p, n < 8 ? n : 8);
+    if (head < 8 || n <= 8) {
+	return head;
+    }
+
+#if defined(__x86_64__)
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    if (ssse3) {
+	return 8 + find_ssse3(set, p + 8, n - 8);
+    }
+#endif
+    return 8 + find_scalar(set, p + 8, n - 8);
+}
+
+/// @description: Count the bytes of p[0, n) equal to b.
+/// @returns: [count -> std::size_t]
+inline std::size_t count(const char *p, std::size_t n, char b) noexcept
+{
+    std::size_t found = 0, i = 0;
+
+#if defined(__SSE2__)
+    const auto needle = _mm_set1_epi8(b);
+    for (; i + 16 <= n; i += 16) {
+	const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+	found += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+    }
+#endif
+
+    for (; i < n; i++) {
+	found += p[i] == b;
+    }
+
+    return found;
+}
+
+/// @description: Length of the all-ASCII prefix of p[0, n).
+/// @returns: [ascii_prefix -> std::size_t]
+inline std::size_t ascii_prefix(const char *p, std::size_t n) noexcept
+{
+    std::size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+	const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+	if (const auto m = _mm_movemask_epi8(v)) {
+	    return i + __builtin_ctz(m);
+	}
+    }
+#endif
+
+    for (; i < n && !(p[i] & 0x80); i++) {
+    }
+
+    return i;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,149 @@
+// Just enough of the ustar/pax format to rewrite member payloads.
+
+#ifndef TAR_H
+# define TAR_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace tar {
+
+inline constexpr std::size_t block = 512;
+
+/// @description: Field offsets inside a header block.
+enum : std::size_t {
+    SIZE_OFF = 124, SIZE_LEN = 12,
+    CHKSUM_OFF = 148, CHKSUM_LEN = 8,
+    TYPE_OFF = 156,
+};
+
+/// @description: Round n up to a whole number of blocks.
+/// @returns: [padded -> std::uint64_t]
+constexpr inline std::uint64_t padded(std::uint64_t n) noexcept
+{
+    return (n + block - 1) / block * block;
+}
+
+/// @description: Test for the all-zero block that ends an archive.
+/// @returns: [is_zero -> bool]
+inline bool is_zero(const char *hdr) noexcept
+{
+    for (std::size_t i = 0; i < block; i++) {
+	if (hdr[i]) {
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+/// @description: Type flag of a header.
+/// @returns: [type -> char]
+inline char type(const char *hdr) noexcept
+{
+    return hdr[TYPE_OFF];
+}
+
+/// @description: Test whether a header describes a regular file, whose
+///               payload is file content.
+/// @returns: [is_regular -> bool]
+inline bool is_regular(const char *hdr) noexcept
+{
+    const auto t = type(hdr);
+    return t == '0' || t == '\0' || t == '7';
+}
+
+/// @description: Decode the size field, octal or GNU base-256.
+/// @returns: [size -> std::uint64_t]
+inline std::uint64_t size(const char *hdr) noexcept
+{
+    const auto *f = reinterpret_cast<const unsigned char *>(hdr + SIZE_OFF);
+    std::uint64_t v = 0;
+
+    if (f[0] & 0x80) {
+	for (std::size_t i = 1; i < SIZE_LEN; i++) {
+	    v = (v << 8) | f[i];
+	}
+	return v;
+    }
+
+    for (std::size_t i = 0; i < SIZE_LEN && f[i]; i++) {
+	if (f[i] >= '0' && f[i] <= '7') {
+	    v = (v << 3) | (f[i] - '0');
+	}
+    }
+
+    return v;
+}
+
+/// @description: Store a size, in octal when it fits and base-256 when not.
+inline void set_size(char *hdr, std::uint64_t v) noexcept
+{
+    auto *f = hdr + SIZE_OFF;
+
+    if (v < (1ull << 33)) {
+	std::snprintf(f, SIZE_LEN, "%011llo", static_cast<unsigned long long>(v));
+	return;
+    }
+
+    f[0] = static_cast<char>(0x80);
+    for (std::size_t i = SIZE_LEN - 1; i > 0; i--, v >>= 8) {
+	f[i] = static_cast<char>(v & 0xff);
+    }
+}
+
+/// @description: Recompute the header checksum after editing fields.
+inline void fix_checksum(char *hdr) noexcept
+{
+    std::memset(hdr + CHKSUM_OFF, ' ', CHKSUM_LEN);
+
+    unsigned sum = 0;
+    for (std::size_t i = 0; i < block; i++) {
+	sum += static_cast<unsigned char>(hdr[i]);
+    }
+    std::snprintf(hdr + CHKSUM_OFF, CHKSUM_LEN - 1, "%06o", sum);
+    hdr[CHKSUM_OFF + CHKSUM_LEN - 1] = ' ';
+}
+
+/// @description: Remove the "size" record from a pax extended header,
+///               since the rewritten ustar size becomes authoritative.
+/// @returns: [drop_pax_size -> bool], whether a size record was found;
+///           its value is stored in found_size.
+inline bool drop_pax_size(std::string &records, std::uint64_t &found_size)
+{
+    std::string kept;
+    bool found = false;
+    std::size_t i = 0;
+
+    while (i < records.size()) {
+	// Each record is "LEN key=value\n", LEN counting the whole record.
+	std::size_t len = 0, j = i;
+	while (j < records.size() && records[j] >= '0' && records[j] <= '9') {
+	    len = len * 10 + (records[j++] - '0');
+	}
+	if (!len || i + len > records.size()) {
+	    kept.append(records, i, std::string::npos);
+	    break;
+	}
+
+	std::string_view rec {records.data() + i, len};
+	const auto sp = rec.find(' ');
+	if (sp != std::string_view::npos && rec.substr(sp + 1, 5) == "size=") {
+	    found_size = std::strtoull(rec.data() + sp + 6, nullptr, 10);
+	    found = true;
+	} else {
+	    kept.append(rec);
+	}
+	i += len;
+    }
+
+    records.swap(kept);
+    return found;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,118 @@
+// Token-bucket bandwidth limiting with smooth pacing.
+
+#ifndef THROTTLE_H
+# define THROTTLE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <mutex>
+#include <time.h>
+
+namespace throttle {
+
+/// @description: Nanoseconds on the monotonic clock.
+/// @returns: [now_ns -> std::int64_t]
+inline std::int64_t now_ns() noexcept
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/// @description: A token bucket refilled at `rate` bytes per second and
+///               holding at most one slice, the amount moved by a single
+///               call: callers cut their I/O into slices of 1/50 of a
+///               second, and each one waits for its own tokens, so the
+///               pace stays even instead of a burst followed by a long
+///               sleep. Several threads may share a bucket.
+struct bucket {
+    std::atomic<std::uint64_t> rate {0};	// Bytes per second; 0: unlimited.
+    std::atomic<bool> on {true};		// Cleared to run at full speed.
+
+    bool limited() const noexcept
+    {
+	return rate.load(std::memory_order_relaxed) && on.load(std::memory_order_relaxed);
+    }
+
+    /// @description: The most a single call should move.
+    /// @returns: [slice -> std::size_t]
+    std::size_t slice(std::size_t want) const noexcept
+    {
+	if (!limited()) {
+	    return want;
+	}
+	const auto s = std::clamp<std::uint64_t>(rate / 50, 4096, 1024 * 1024);
+	return static_cast<std::size_t>(std::min<std::uint64_t>(want, s));
+    }
+
+    /// @description: Spend n bytes of tokens, sleeping until the bucket
+    ///               has paid for them. Turning the limit off wakes a
+    ///               sleeper at the next signal.
+    void take(std::uint64_t n)
+    {
+	if (!limited()) {
+	    return;
+	}
+
+	std::int64_t wake;
+	{
+	    std::lock_guard<std::mutex> g {lock};
+	    const auto r = static_cast<double>(rate.load(std::memory_order_relaxed));
+	    const auto now = now_ns();
+	    const double cap = std::clamp(r / 50, 4096.0, 1024.0 * 1024);
+
+	    if (last) {
+		tokens = std::min(cap, tokens + (now - last) * r / 1e9);
+	    } else {
+		tokens = cap;
+	    }
+	    last = now;
+	    tokens -= static_cast<double>(n);
+	    if (tokens >= 0) {
+		return;
+	    }
+
+	    // Pay the debt off by sleeping; the next caller starts from it.
+	    wake = now + static_cast<std::int64_t>(-tokens / r * 1e9);
+	    tokens = 0;
+	    last = wake;
+	}
+
+	const timespec ts {static_cast<time_t>(wake / 1000000000), static_cast<long>(wake % 1000000000)};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+	    if (!limited()) {
+		break;
+	    }
+	}
+    }
+
+private:
+    std::mutex lock;
+    double tokens = 0;
+    std::int64_t last = 0;
+};
+
+/// @description: Parse a rate such as "500K", "20M" or "1G", in bytes
+///               per second with binary multiples.
+/// @returns: [parse_rate -> std::uint64_t], 0 when malformed.
+inline std::uint64_t parse_rate(const char *s) noexcept
+{
+    std::uint64_t v = 0;
+    for (; *s >= '0' && *s <= '9'; s++) {
+	v = v * 10 + static_cast<std::uint64_t>(*s - '0');
+    }
+
+    switch (*s) {
+    case 'k': case 'K': v <<= 10; s++; break;
+    case 'm': case 'M': v <<= 20; s++; break;
+    case 'g': case 'G': v <<= 30; s++; break;
+    }
+
+    return *s ? 0 : v;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,357 @@
+// UTF-8 sequence checks, with the ASCII parts skipped in bulk.
+
+#ifndef UTF8_H
+# define UTF8_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "simd.h"
+
+namespace utf8 {
+
+/// @description: Outcome of checking the sequence starting at a lead byte.
+enum : int {
+    INVALID = 0,		// Not the start of a valid sequence.
+    INCOMPLETE = -1,		// Valid so far, but cut off by the end of input.
+};
+
+/// @description: Check the multi-byte sequence at p, rejecting overlong
+///               forms, surrogates and code points past U+10FFFF.
+/// @returns: [sequence -> int], its length, INVALID or INCOMPLETE.
+inline int sequence(const unsigned char *p, std::size_t n) noexcept
+{
+    const auto c = p[0];
+    int len;
+    unsigned char lo = 0x80, hi = 0xbf;	// Range of the second byte.
+
+    if (c >= 0xc2 && c <= 0xdf) {
+	len = 2;
+    } else if (c >= 0xe0 && c <= 0xef) {
+	len = 3;
+	lo = c == 0xe0 ? 0xa0 : lo;
+	hi = c == 0xed ? 0x9f : hi;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+	len = 4;
+	lo = c == 0xf0 ? 0x90 : lo;
+	hi = c == 0xf4 ? 0x8f : hi;
+    } else {
+	return INVALID;
+    }
+
+    for (int i = 1; i < len; i++) {
+	if (static_cast<std::size_t>(i) >= n) {
+	    return INCOMPLETE;
+	}
+	const auto b = p[i];
+	if (i == 1 ? (b < lo || b > hi) : (b & 0xc0) != 0x80) {
+	    return INVALID;
+	}
+    }
+
+    return len;
+}
+
+/// @description: Count the bytes of p[0, n) that do not start or belong to
+///               a valid sequence. A sequence cut off by the end of the
+///               buffer is not counted.
+/// @returns: [count_invalid -> std::size_t]
+inline std::size_t count_invalid(const char *p, std::size_t n) noexcept
+{
+    const auto *u = reinterpret_cast<const unsigned char *>(p);
+    std::size_t bad = 0, i = 0;
+
+    while (i < n) {
+	i += simd::ascii_prefix(p + i, n - i);
+	if (i == n) {
+	    break;
+	}
+
+	const auto r = sequence(u + i, n - i);
+	if (r == INCOMPLETE) {
+	    break;
+	}
+	if (r == INVALID) {
+	    bad++;
+	    i++;
+	} else {
+	    i += r;
+	}
+    }
+
+    return bad;
+}
+
+/// @description: Match the invisible character encoded at p: zero-width
+///               U+200B-U+200F and U+2060-U+2064, bidi controls
+///               U+202A-U+202E and U+2066-U+2069, or the BOM U+FEFF. All of
+///               them take 3 bytes, led by 0xE2 or 0xEF.
+/// @returns: [invisible -> int], 3, INVALID, or INCOMPLETE when p[0, n)
+///           is a cut-off prefix of one.
+inline int invisible(const unsigned char *p, std::size_t n) noexcept
+{
+    if (n == 0 || (p[0] != 0xe2 && p[0] != 0xef)) {
+	return INVALID;
+    }
+    if (n == 1) {
+	return INCOMPLETE;
+    }
+
+    const auto mid = p[1];
+    if (p[0] == 0xef ? mid != 0xbb : (mid != 0x80 && mid != 0x81)) {
+	return INVALID;
+    }
+    if (n == 2) {
+	return INCOMPLETE;
+    }
+
+    const auto c = p[2];
+    const bool hit = p[0] == 0xef ? c == 0xbf :
+	mid == 0x80 ? (c >= 0x8b && c <= 0x8f) || (c >= 0xaa && c <= 0xae) :
+	(c >= 0xa0 && c <= 0xa4) || (c >= 0xa6 && c <= 0xa9);
+
+    return hit ? 3 : INVALID;
+}
+
+#if defined(__x86_64__)
+/// @description: Error bits of the 16 bytes of v, given the 16 bytes before
+///               them, after Keiser and Lemire: every byte is classified
+///               with the one before it by three nibble lookups whose AND
+///               is non-zero only for a bad pair, and bytes that must
+///               continue a 3- or 4-byte sequence are checked apart.
+/// @returns: [errors_ssse3 -> __m128i], all zero when the block is valid.
+__attribute__((target("ssse3")))
+inline __m128i errors_ssse3(__m128i v, __m128i prev) noexcept
+{
+    enum : char {
+	TOO_SHORT = 1 << 0, TOO_LONG = 1 << 1, OVERLONG_3 = 1 << 2,
+	TOO_LARGE = 1 << 3, SURROGATE = 1 << 4, OVERLONG_2 = 1 << 5,
+	TOO_LARGE_1000 = 1 << 6, OVERLONG_4 = 1 << 6,
+	TWO_CONTS = static_cast<char>(1 << 7),
+	CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS,
+    };
+
+    const auto nib = _mm_set1_epi8(0x0f);
+    const auto prev1 = _mm_alignr_epi8(v, prev, 15);
+
+    const auto byte_1_high = _mm_shuffle_epi8(_mm_setr_epi8(
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+	TOO_SHORT | OVERLONG_2,
+	TOO_SHORT,
+	TOO_SHORT | OVERLONG_3 | SURROGATE,
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4),
+	_mm_and_si128(_mm_srli_epi16(prev1, 4), nib));
+
+    const auto byte_1_low = _mm_shuffle_epi8(_mm_setr_epi8(
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+	CARRY | OVERLONG_2,
+	CARRY,
+	CARRY,
+	CARRY | TOO_LARGE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000),
+	_mm_and_si128(prev1, nib));
+
+    const auto byte_2_high = _mm_shuffle_epi8(_mm_setr_epi8(
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT),
+	_mm_and_si128(_mm_srli_epi16(v, 4), nib));
+
+    const auto special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low),
+				       byte_2_high);
+
+    // Third bytes of 3- and 4-byte sequences and fourth bytes of 4-byte
+    // ones must be continuations, which the pair check alone reads as
+    // TWO_CONTS; the high bit set here flips that back.
+    const auto third = _mm_subs_epu8(_mm_alignr_epi8(v, prev, 14), _mm_set1_epi8(0xe0 - 0x80));
+    const auto fourth = _mm_subs_epu8(_mm_alignr_epi8(v, prev, 13), _mm_set1_epi8(0xf0 - 0x80));
+    const auto must = _mm_and_si128(_mm_or_si128(third, fourth),
+				    _mm_set1_epi8(static_cast<char>(0x80)));
+
+    return _mm_xor_si128(must, special);
+}
+
+/// @description: Check p[0, n), n a multiple of 16, following the bytes
+///               of an unfinished sequence carried over from before it.
+///               A sequence cut off at the end of p is not an error.
+/// @returns: [valid_ssse3 -> bool]
+__attribute__((target("ssse3")))
+inline bool valid_ssse3(const char *p, std::size_t n,
+			const unsigned char *carry, std::size_t ncarry) noexcept
+{
+    alignas(16) unsigned char before[16] {};
+    std::memcpy(before + 16 - ncarry, carry, ncarry);
+
+    auto prev = _mm_load_si128(reinterpret_cast<const __m128i *>(before));
+    auto err = _mm_setzero_si128();
+    for (std::size_t i = 0; i < n; i += 16) {
+	const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+	err = _mm_or_si128(err, errors_ssse3(v, prev));
+	prev = v;
+    }
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128())) == 0xffff;
+}
+#endif
+
+/// @description: Streaming check that input is ASCII, or valid UTF-8, fed
+///               one chunk at a time; a sequence cut by the end of a chunk
+///               is carried over to the next one.
+struct validator {
+    static constexpr std::uint64_t none = ~std::uint64_t {0};
+
+    bool ascii = false;
+    std::uint64_t offset = 0;		// Bytes fed so far.
+    std::uint64_t bad = none;		// Offset of the first invalid byte.
+
+    /// @description: Check the next n bytes of the input.
+    /// @returns: [feed -> bool], false once an invalid byte was seen.
+    bool feed(const char *p, std::size_t n) noexcept
+    {
+	if (!ok()) {
+	    return false;
+	}
+
+	if (ascii) {
+	    const auto i = simd::ascii_prefix(p, n);
+	    if (i < n) {
+		bad = offset + i;
+		return false;
+	    }
+	    offset += n;
+	    return true;
+	}
+
+#if defined(__x86_64__)
+	// Whole blocks are checked wide; only when that fails, or for the
+	// tail, does the walk below look at sequences one by one.
+	static const bool ssse3 = __builtin_cpu_supports("ssse3");
+	const auto wide = n & ~std::size_t {15};
+	if (ssse3 && wide && valid_ssse3(p, wide, carry, ncarry)) {
+	    const auto skip = resync(p, wide);
+	    ncarry = 0;
+	    offset += skip;
+	    p += skip;
+	    n -= skip;
+	}
+#endif
+
+	return walk(p, n);
+    }
+
+    /// @description: Account for n zero bytes, e.g. a hole of the input.
+    /// @returns: [zeros -> bool], false once an invalid byte was seen.
+    bool zeros(std::uint64_t n) noexcept
+    {
+	if (ok() && ncarry) {
+	    bad = offset - ncarry;
+	}
+	offset += n;
+	return ok();
+    }
+
+    /// @description: End the input; a sequence left unfinished is invalid.
+    /// @returns: [finish -> bool]
+    bool finish() noexcept
+    {
+	return zeros(0);
+    }
+
+    bool ok() const noexcept
+    {
+	return bad == none;
+    }
+
+private:
+    unsigned char carry[3];
+    std::size_t ncarry = 0;
+
+    /// @description: Where to resume after the wide check of p[0, n): the
+    ///               lead byte of the sequence that may run past n, or n.
+    /// @returns: [resync -> std::size_t]
+    static std::size_t resync(const char *p, std::size_t n) noexcept
+    {
+	const auto *u = reinterpret_cast<const unsigned char *>(p);
+	for (std::size_t k = 1; k <= 3; k++) {
+	    const auto c = u[n - k];
+	    if ((c & 0xc0) != 0x80) {
+		return c >= 0xc0 ? n - k : n;
+	    }
+	}
+
+	return n;
+    }
+
+    /// @description: Check p[0, n) one sequence at a time.
+    /// @returns: [walk -> bool]
+    bool walk(const char *p, std::size_t n) noexcept
+    {
+	const auto *u = reinterpret_cast<const unsigned char *>(p);
+	std::size_t i = 0;
+
+	if (ncarry) {
+	    unsigned char seq[4];
+	    const auto take = std::min<std::size_t>(4 - ncarry, n);
+	    std::memcpy(seq, carry, ncarry);
+	    std::memcpy(seq + ncarry, u, take);
+
+	    const auto r = sequence(seq, ncarry + take);
+	    if (r == INVALID) {
+		bad = offset - ncarry;
+		return false;
+	    }
+	    if (r == INCOMPLETE) {
+		std::memcpy(carry + ncarry, u, n);
+		ncarry += n;
+		offset += n;
+		return true;
+	    }
+	    i = r - ncarry;
+	    ncarry = 0;
+	}
+
+	while (i < n) {
+	    i += simd::ascii_prefix(p + i, n - i);
+	    if (i == n) {
+		break;
+	    }
+
+	    const auto r = sequence(u + i, n - i);
+	    if (r == INVALID) {
+		bad = offset + i;
+		return false;
+	    }
+	    if (r == INCOMPLETE) {
+		ncarry = n - i;
+		std::memcpy(carry, u + i, ncarry);
+		break;
+	    }
+	    i += r;
+	}
+
+	offset += n;
+	return true;
+    }
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,197 @@
+// Lazy range views over filtered bytes, for C++20 range pipelines.
+
+#ifndef VIEWS_H
+# define VIEWS_H
+
+#if __has_include(<version>)
+# include <version>
+#endif
+
+#if defined(__cpp_lib_ranges)
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+
+#include "filter.h"
+#include "simd.h"
+
+namespace xc::views {
+
+/// @description: Test whether a view can strip for the pattern: every
+///               literal it has is removed without limit. A quota that
+///               runs out needs state a view does not keep.
+/// @returns: [strippable -> bool]
+inline bool strippable(const pattern &pat) noexcept
+{
+    for (int c = 0; c < 256; c++) {
+	if ((pat.flags[c] & F_QUOTA) &&
+	    pat.quota[c] != std::numeric_limits<std::int64_t>::max()) {
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+/// @description: The bytes a pattern keeps wherever they are: everything
+///               but the ones its pretypes drop anywhere and its literals,
+///               which have to be strippable(). Line rules need state or
+///               lookahead, so a view leaves them be.
+/// @returns: [kept_bytes -> simd::byteset]
+inline simd::byteset kept_bytes(const pattern &pat) noexcept
+{
+    assert(strippable(pat));
+
+    simd::byteset kept;
+    for (int c = 0; c < 256; c++) {
+	if (!(pat.flags[c] & (F_DROP | F_QUOTA))) {
+	    kept.add(static_cast<unsigned char>(c));
+	}
+    }
+
+    return kept;
+}
+
+/// @description: A view of the bytes of a contiguous range that the
+///               pattern keeps. Stepping forward searches for the next kept
+///               byte with simd::find(), so a run of dropped bytes is
+///               skipped 16 at a time and a kept one costs a single test.
+template <std::ranges::view V>
+    requires std::ranges::contiguous_range<V> &&
+	     (sizeof(std::ranges::range_value_t<V>) == 1)
+class strip_view : public std::ranges::view_interface<strip_view<V>> {
+    using elem = std::remove_reference_t<std::ranges::range_reference_t<const V>>;
+
+public:
+    class iterator {
+    public:
+	using iterator_concept = std::forward_iterator_tag;
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = std::remove_cv_t<elem>;
+	using difference_type = std::ptrdiff_t;
+
+	iterator() = default;
+
+	iterator(elem *p, elem *end, const simd::byteset *kept) noexcept
+	    : p(p), end(end), kept(kept)
+	{
+	    skip();
+	}
+
+	elem &operator*() const noexcept
+	{
+	    return *p;
+	}
+
+	iterator &operator++() noexcept
+	{
+	    ++p;
+	    skip();
+	    return *this;
+	}
+
+	iterator operator++(int) noexcept
+	{
+	    auto old = *this;
+	    ++*this;
+	    return old;
+	}
+
+	friend bool operator==(const iterator &a, const iterator &b) noexcept
+	{
+	    return a.p == b.p;
+	}
+
+    private:
+	elem *p = nullptr;
+	elem *end = nullptr;
+	const simd::byteset *kept = nullptr;
+
+	/// @description: Move p to the next kept byte, or to the end.
+	void skip() noexcept
+	{
+	    const auto n = static_cast<std::size_t>(end - p);
+	    p += simd::find(*kept, reinterpret_cast<const char *>(p), n);
+	}
+    };
+
+    strip_view()
+	requires std::default_initializable<V> = default;
+
+    strip_view(V base, const pattern &pat)
+	: base_(std::move(base)), kept_(kept_bytes(pat))
+    {
+    }
+
+    V base() const &
+	requires std::copy_constructible<V>
+    {
+	return base_;
+    }
+
+    V base() &&
+    {
+	return std::move(base_);
+    }
+
+    iterator begin() const
+    {
+	auto *p = std::ranges::data(base_);
+	return {p, p + std::ranges::size(base_), &kept_};
+    }
+
+    iterator end() const
+    {
+	auto *e = std::ranges::data(base_) + std::ranges::size(base_);
+	return {e, e, &kept_};
+    }
+
+private:
+    V base_;
+    simd::byteset kept_;
+};
+
+template <typename R>
+strip_view(R &&, const pattern &) -> strip_view<std::views::all_t<R>>;
+
+/// @description: The adaptor object returned by strip(pattern), applied
+///               with `range | strip(pattern)`. It refers to the pattern;
+///               a view made from it keeps its own copy of the kept set.
+struct strip_closure {
+    const pattern *pat;
+
+    template <std::ranges::viewable_range R>
+    friend auto operator|(R &&r, const strip_closure &c)
+    {
+	return strip_view(std::forward<R>(r), *c.pat);
+    }
+};
+
+/// @description: Lazily drop the bytes the pattern removes anywhere, as in
+///               `text | xc::views::strip(pat) | std::views::take(80)`.
+///               The pattern must outlive the adaptor, not the view.
+/// @returns: [strip -> strip_closure]
+inline strip_closure strip(const pattern &pat) noexcept
+{
+    return {&pat};
+}
+
+/// @description: strip(pattern) applied to r directly.
+/// @returns: [strip -> strip_view]
+template <std::ranges::viewable_range R>
+auto strip(R &&r, const pattern &pat)
+{
+    return strip_view(std::forward<R>(r), pat);
+}
+
+} // namespace
+
+#endif
+
+#endif
@@ -1,22 +1,61 @@
-#include <iostream>
 #include <algorithm>
+#include <cstring>
 #include <string>
 #include <memory>
+#include <deque>
 #include <filesystem>
-#include <system_error>
+#include <functional>
+#include <future>
+#include <optional>
+#include <thread>
+#include <vector>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <signal.h>
 #include <getopt.h>
 
 #include "char_type.h"
+#include "crc32c.h"
+#include "filter.h"
+#include "line_changes.h"
+#include "line_index.h"
+#include "parallel.h"
+#include "rcu.h"
+#include "report.h"
+#include "show.h"
+#include "sidecar.h"
+#include "tar.h"
+#include "throttle.h"
+#include "utf8.h"
+
+/// @Description: Write "error: what[: why]" to stderr with a single write(),
+///               so that no stream machinery has to be set up at startup.
+/// @Returns: print_error returns a void.
+static void print_error(const std::string_view &what,
+			const std::string_view &why = {})
+{
+    std::string line {"error: "};
+    line.append(what);
+    if (!why.empty()) {
+	line.append(": ");
+	line.append(why);
+    }
+    line.push_back('\n');
+
+    if (write(STDERR_FILENO, line.data(), line.size()) == -1) {
+	// Nowhere left to report it.
+    }
+}
 
 /// @Description: Helper function to display fatal error message and then exit.
 /// @Returns: fatal_error returns a void.
 [[noreturn]]
 static void fatal_error(const std::string_view &func)
 {
-    auto error = std::generic_category().default_error_condition(errno);
-    std::cerr << "error: " << func << ": " << error.message() << '\n';
+    print_error(func, std::strerror(errno));
     std::exit(1);
 }
 
@@ -24,206 +63,1730 @@ static void fatal_error(const std::string_view &func)
 ///               and then exit.
 /// @Returns: fatal_errorx returns a void.
 [[noreturn]]
-static void fatal_errorx(const std::string_view &emsg)
+static void fatal_errorx(const std::string_view &emsg)
+{
+    print_error(emsg);
+    std::exit(1);
+}
+
+/// @Description: Open the input file, "-" being the standard input.
+/// @Returns: open_input returns a file descriptor.
+static int open_input(const std::string &fname)
+{
+    if (fname == "-") {
+	return STDIN_FILENO;
+    }
+
+    auto fd = open(fname.c_str(), O_RDONLY);
+    if (fd == -1) {
+	if (errno == ENOENT) {
+	    fatal_errorx("input file path was not found.");
+	}
+        fatal_error("open()");
+    }
+
+    return fd;
+}
+
+// Bandwidth limits (--bwlimit) on everything read and written.
+static throttle::bucket read_limit, write_limit;
+
+/// @Description: Read up to len bytes from fd, retrying on signals.
+/// @Returns: read_some returns the byte count, 0 at the end of file.
+static std::size_t read_some(int fd, char *buf, std::size_t len)
+{
+    for (;;) {
+	auto n = read(fd, buf, read_limit.slice(len));
+	if (n >= 0) {
+	    read_limit.take(static_cast<std::uint64_t>(n));
+	    return static_cast<std::size_t>(n);
+	}
+	if (errno != EINTR) {
+	    fatal_error("read()");
+	}
+    }
+}
+
+/// @Description: Write the whole buffer to fd, retrying short writes.
+/// @Returns: write_all returns a void.
+static void write_all(int fd, const char *buf, std::size_t len)
+{
+    while (len) {
+	auto n = write(fd, buf, write_limit.slice(len));
+	if (n == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    fatal_error("write()");
+	}
+	write_limit.take(static_cast<std::uint64_t>(n));
+	buf += n;
+	len -= static_cast<std::size_t>(n);
+    }
+}
+
+/// @Description: Buffered writer for the filtered output. When a checksum
+///               was asked for, bytes are hashed here as they go out, so
+///               the output never has to be read back.
+struct output_sink {
+    static constexpr std::size_t cap = 64 * 1024;
+
+    int fd = STDOUT_FILENO;
+    crc32c::state *sum = nullptr;
+    std::string buf;
+
+    void write(const char *p, std::size_t n)
+    {
+	if (sum) {
+	    sum->update(p, n);
+	}
+
+	if (buf.size() + n > cap) {
+	    flush();
+	    if (n >= cap) {
+		write_all(fd, p, n);
+		return;
+	    }
+	}
+	buf.append(p, n);
+    }
+
+    void flush()
+    {
+	write_all(fd, buf.data(), buf.size());
+	buf.clear();
+    }
+
+    /// @Description: Write len NUL bytes, as a hole when the output is a
+    ///               regular file and nothing hashes it.
+    void zeros(std::uint64_t len)
+    {
+	if (regular == -1) {
+	    struct stat st;
+	    regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+	}
+
+	if (regular && !sum) {
+	    flush();
+	    auto end = lseek(fd, static_cast<off_t>(len), SEEK_CUR);
+	    if (end == -1 || ftruncate(fd, end) == -1) {
+		fatal_error("lseek()");
+	    }
+	    return;
+	}
+
+	const std::string block(std::min<std::uint64_t>(len, cap), '\0');
+	for (; len > block.size(); len -= block.size()) {
+	    write(block.data(), block.size());
+	}
+	write(block.data(), len);
+    }
+
+private:
+    int regular = -1;
+};
+
+/// @Description: Report the output checksum on stderr, or in a file.
+/// @Returns: report_checksum returns a void.
+static void report_checksum(const crc32c::state &sum, const std::string &dest)
+{
+    char line[32];
+    auto len = std::snprintf(line, sizeof(line), "crc32c:%08x\n", sum.value());
+
+    if (dest.empty()) {
+	write_all(STDERR_FILENO, line, len);
+	return;
+    }
+
+    auto fd = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+	fatal_error("open()");
+    }
+    write_all(fd, line, len);
+    close(fd);
+}
+
+/// @Description: One element of a pattern argument.
+struct pattern_token {
+    std::string_view text;		// As written, anchor included.
+    const xc::pretype *pt;		// nullptr for a literal byte.
+    xc::anchor at;
+};
+
+/// @Description: Split the pattern argument into bracketed pretypes, with
+///               "^" before or "$" after them when they only apply at the
+///               start or the end of a line, and literal bytes. An
+///               unknown pretype is fatal, unless `unknown` is given to
+///               be set instead.
+/// @Returns: tokenize_pattern returns the tokens in order.
+static std::vector<pattern_token> tokenize_pattern(std::string_view args,
+						   bool *unknown = nullptr)
+{
+    std::vector<pattern_token> tokens;
+    for (std::size_t i = 0; i < args.size();) {
+	// "^[:x:]" only trims the start of a line, "[:x:]$" only its end.
+	auto at = xc::anchor::anywhere;
+	auto from = i;
+	if (args[i] == '^' && args.compare(i + 1, 2, "[:") == 0) {
+	    at = xc::anchor::line_start;
+	    from++;
+	}
+
+	if (args.compare(from, 2, "[:") == 0) {
+	    auto end = args.find(":]", from + 2);
+	    if (end != std::string_view::npos) {
+		auto pt = xc::find_pretype(args.substr(from, end + 2 - from));
+		if (!pt) {
+		    if (unknown) {
+			*unknown = true;
+			return tokens;
+		    }
+		    fatal_errorx("unknown pretype in pattern.");
+		}
+
+		auto next = end + 2;
+		if (at == xc::anchor::anywhere && next < args.size() && args[next] == '$') {
+		    at = xc::anchor::line_end;
+		    next++;
+		}
+		tokens.push_back({args.substr(i, next - i), pt, at});
+		i = next;
+		continue;
+	    }
+	}
+
+	tokens.push_back({args.substr(i, 1), nullptr, xc::anchor::anywhere});
+	i++;
+    }
+
+    return tokens;
+}
+
+/// @Description: Compile the pattern argument into a single classifier
+///               table. Pretypes remove every byte they match, or only
+///               leading/trailing ones; a literal is removed up to `times`
+///               times.
+/// @Returns: compile_pattern returns a xc::pattern.
+static xc::pattern compile_pattern(const std::string &args, std::int64_t times)
+{
+    if (times < 0) {
+	fatal_errorx("size of how many, cannot be less than 0.");
+    }
+
+    xc::pattern pat;
+    for (const auto &tok : tokenize_pattern(args)) {
+	if (tok.pt) {
+	    pat.add_pretype(*tok.pt, tok.at);
+	} else {
+	    pat.add_literal(static_cast<unsigned char>(tok.text[0]), times);
+	}
+    }
+
+    return pat;
+}
+
+/// @Description: Share of each byte value in typical text, for the cost
+///               estimate of --explain when there is no input to sample:
+///               mostly lowercase letters, blanks and punctuation, a few
+///               line ends, digits and capitals, and a little UTF-8.
+/// @Returns: text_share returns a fraction of all bytes.
+static double text_share(int c)
+{
+    if (char_type::islower(c)) {
+	return 0.55 / 26;
+    }
+    if (char_type::isupper(c)) {
+	return 0.04 / 26;
+    }
+    if (char_type::isdigit(c)) {
+	return 0.04 / 10;
+    }
+    if (char_type::ispunct(c)) {
+	return 0.175 / 32;
+    }
+
+    switch (c) {
+    case ' ':
+	return 0.15;
+    case '\n':
+	return 0.025;
+    case '\t':
+	return 0.01;
+    }
+
+    return c >= 0x80 ? 0.01 / 128 : 0.0;
+}
+
+/// @Description: Print how the pattern was compiled and how it will run:
+///               its tokens, the merged table, quotas, the engine and a
+///               rough bytes/cycle estimate, from the start of the input
+///               when there is one, else from a built-in text profile.
+/// @Returns: explain_pattern returns a void.
+static void explain_pattern(std::string_view args, const xc::pattern &pat,
+			    const std::string &sample)
+{
+    std::string out;
+    char num[64];
+
+    auto byte_name = [&num](int c) {
+	if (c > ' ' && c < 0x7f) {
+	    return std::string(1, static_cast<char>(c));
+	}
+	std::snprintf(num, sizeof(num), "0x%02x", c);
+	return std::string(num);
+    };
+
+    out.append("pattern: \"").append(args).append("\"\ntokens:\n");
+    for (const auto &tok : tokenize_pattern(args)) {
+	out.append("  ").append(tok.text);
+	out.append(tok.text.size() < 14 ? 14 - tok.text.size() : 1, ' ');
+	if (!tok.pt) {
+	    out.append("literal ").append(byte_name(static_cast<unsigned char>(tok.text[0])));
+	} else {
+	    out.append(tok.pt->name);
+	    out.append(tok.at == xc::anchor::line_start ? " at line start" :
+		       tok.at == xc::anchor::line_end ? " at line end" : " anywhere");
+	}
+	out.push_back('\n');
+    }
+
+    std::string rules;
+    if (pat.flags['\r'] & xc::F_CR) {
+	rules.append(" crlf");
+    }
+    if (pat.squeeze) {
+	rules.append(" squeeze-blank");
+    }
+    if (pat.used & xc::F_INVIS) {
+	rules.append(" strip-invisible");
+    }
+    if (!pat.cols.empty()) {
+	rules.append(" columns");
+	char sep = ' ';
+	for (const auto &[from, to] : pat.cols) {
+	    std::snprintf(num, sizeof(num), "%c%llu-", sep, static_cast<unsigned long long>(from + 1));
+	    rules.append(num);
+	    if (to != std::numeric_limits<std::uint64_t>::max()) {
+		rules.append(std::to_string(to));
+	    }
+	    sep = ',';
+	}
+    }
+    out.append("rules:").append(rules.empty() ? " none" : rules).push_back('\n');
+
+    int flagged = 0;
+    for (const auto f : pat.flags) {
+	flagged += f != 0;
+    }
+    out.append("table: ").append(std::to_string(flagged)).append(" of 256 bytes flagged\n");
+
+    static constexpr std::pair<std::uint8_t, std::string_view> names[] = {
+	{xc::F_DROP, "drop"}, {xc::F_QUOTA, "quota"}, {xc::F_LEAD, "lead"},
+	{xc::F_TRAIL, "trail"}, {xc::F_EOL, "eol"}, {xc::F_CR, "cr"},
+	{xc::F_INVIS, "invis"},
+    };
+    for (const auto &[flag, name] : names) {
+	if (!(pat.used & flag)) {
+	    continue;
+	}
+	out.append("  ").append(name).append(8 - name.size(), ' ');
+	for (int c = 0; c < 256;) {
+	    if (!(pat.flags[c] & flag)) {
+		c++;
+		continue;
+	    }
+	    auto last = c;
+	    while (last < 255 && (pat.flags[last + 1] & flag)) {
+		last++;
+	    }
+	    out.append(" ").append(byte_name(c));
+	    if (last > c) {
+		out.append("-").append(byte_name(last));
+	    }
+	    c = last + 1;
+	}
+	out.push_back('\n');
+    }
+
+    out.append("quotas:");
+    bool any_quota = false;
+    for (int c = 0; c < 256; c++) {
+	if (pat.quota[c] > 0) {
+	    any_quota = true;
+	    out.append(" ").append(byte_name(c)).append("=");
+	    out.append(pat.quota[c] == std::numeric_limits<std::int64_t>::max() ?
+		       "unlimited" : std::to_string(pat.quota[c]));
+	}
+    }
+    out.append(any_quota ? "\n" : " none\n");
+
+#if defined(__x86_64__)
+    const bool wide = __builtin_cpu_supports("ssse3");
+#else
+    const bool wide = false;
+#endif
+    out.append("engine: one merged table; clean runs are found ");
+    out.append(wide ? "16 bytes at a time with SSSE3 pshufb\n" : "a byte at a time (scalar)\n");
+    out.append("passes: 1\n");
+    out.append("passthrough: ");
+    out.append(!pat.used && pat.cols.empty() && !pat.squeeze ? "always, nothing can be removed\n" :
+	       pat.quota_only() ? "kernel copy once the quotas are spent\n" : "no\n");
+    out.append("split by --index -j: ").append(pat.line_local() ? "yes\n" : "no\n");
+
+    // Bytes of clean runs cost the scan; each flagged byte breaks out of
+    // it, and one held back until the next byte costs a little more.
+    std::array<double, 256> share {};
+    std::string from = "built-in text profile";
+    if (!sample.empty() && sample != "-") {
+	auto fd = open_input(sample);
+	char buf[64 * 1024];
+	std::size_t n = 0;
+	while (n < sizeof(buf)) {
+	    const auto got = read_some(fd, buf + n, sizeof(buf) - n);
+	    if (!got) {
+		break;
+	    }
+	    n += got;
+	}
+	close(fd);
+	for (std::size_t i = 0; i < n; i++) {
+	    share[static_cast<unsigned char>(buf[i])] += 1.0 / n;
+	}
+	from = "first " + std::to_string(n) + " bytes of " + sample;
+    } else {
+	for (int c = 0; c < 256; c++) {
+	    share[c] = text_share(c);
+	}
+    }
+
+    double hit = 0, held = 0;
+    for (int c = 0; c < 256; c++) {
+	hit += pat.flags[c] ? share[c] : 0;
+	held += (pat.flags[c] & (xc::F_TRAIL | xc::F_CR)) ? share[c] : 0;
+    }
+    const double scan = wide ? 0.3 : 1.2;
+    double cycles = (1 - hit) * scan + hit * 8 + held * 4 + 0.1;
+    if (!pat.cols.empty()) {
+	cycles += share['\n'] * 20;
+    }
+    std::snprintf(num, sizeof(num), "%.2f", 1 / cycles);
+    out.append("estimate: ").append(num).append(" bytes/cycle, ");
+    std::snprintf(num, sizeof(num), "%.1f%%", hit * 100);
+    out.append(num).append(" of bytes flagged (").append(from).append(")\n");
+
+    write_all(STDOUT_FILENO, out.data(), out.size());
+}
+
+/// @Description: Parse a cut -c style column list, e.g. "1-20,31-" or
+///               "-8,12", into the pattern.
+/// @Returns: cut_column_list returns a void.
+static void cut_column_list(xc::pattern &pat, std::string_view list)
+{
+    constexpr auto open_end = std::numeric_limits<std::uint64_t>::max();
+
+    auto number = [](std::string_view s, std::uint64_t blank) {
+	if (s.empty()) {
+	    return blank;
+	}
+	std::uint64_t v = 0;
+	for (const auto c : s) {
+	    if (c < '0' || c > '9') {
+		fatal_errorx("--cut-cols takes a list like 1-20,31-.");
+	    }
+	    v = v * 10 + static_cast<std::uint64_t>(c - '0');
+	}
+	return v;
+    };
+
+    while (!list.empty()) {
+	const auto comma = std::min(list.find(','), list.size());
+	const auto item = list.substr(0, comma);
+	list.remove_prefix(std::min(comma + 1, list.size()));
+
+	const auto dash = item.find('-');
+	const auto first = dash == std::string_view::npos ? number(item, 0) :
+	    number(item.substr(0, dash), 1);
+	const auto last = dash == std::string_view::npos ? first :
+	    number(item.substr(dash + 1), open_end);
+	if (!first || last < first) {
+	    fatal_errorx("--cut-cols takes a list like 1-20,31-.");
+	}
+	pat.cut_columns(first, last);
+    }
+}
+
+/// @Description: Copy exactly len bytes from fd to the output sink.
+/// @Returns: copy_exact returns false if fd ended early.
+static bool copy_exact(int fd, std::uint64_t len, output_sink &sink)
+{
+    char buf[64 * 1024];
+
+    while (len) {
+	auto n = read_some(fd, buf, std::min<std::uint64_t>(len, sizeof(buf)));
+	if (n == 0) {
+	    return false;
+	}
+	sink.write(buf, n);
+	len -= n;
+    }
+
+    return true;
+}
+
+/// @Description: Rebuild the original input from a filtered output and the
+///               sidecar written alongside it, streaming both.
+/// @Returns: restore returns a void.
+static void restore(const std::string &out_name, const std::string &sc_name,
+		    output_sink &sink)
+{
+    auto out_fd = open_input(out_name);
+
+    auto sc_fd = open(sc_name.c_str(), O_RDONLY);
+    if (sc_fd == -1) {
+	fatal_error("open()");
+    }
+
+    sidecar::reader rd {sc_fd};
+    if (!rd.header()) {
+	fatal_errorx("not a sidecar file.");
+    }
+
+    for (;;) {
+	std::uint64_t len_flag, gap;
+	if (!rd.varint(len_flag)) {
+	    fatal_errorx("truncated sidecar.");
+	}
+	if (len_flag == 0) {
+	    break;
+	}
+	if (!rd.varint(gap)) {
+	    fatal_errorx("truncated sidecar.");
+	}
+	if (!copy_exact(out_fd, gap, sink)) {
+	    fatal_errorx("sidecar does not match the output file.");
+	}
+
+	auto len = len_flag >> 1;
+	if (len_flag & 1) {
+	    unsigned char c;
+	    if (!rd.get(c)) {
+		fatal_errorx("truncated sidecar.");
+	    }
+	    const std::string fill(std::min<std::uint64_t>(len, output_sink::cap),
+				   static_cast<char>(c));
+	    for (; len > fill.size(); len -= fill.size()) {
+		sink.write(fill.data(), fill.size());
+	    }
+	    sink.write(fill.data(), len);
+	    continue;
+	}
+
+	while (len) {
+	    auto sv = rd.bytes(len);
+	    if (sv.empty()) {
+		fatal_errorx("truncated sidecar.");
+	    }
+	    sink.write(sv.data(), sv.size());
+	    len -= sv.size();
+	}
+    }
+
+    copy_exact(out_fd, std::numeric_limits<std::uint64_t>::max(), sink);
+    close(sc_fd);
+    close(out_fd);
+}
+
+/// @Description: Read exactly len bytes from fd into buf, failing with
+///               the message truncated when fd ends part way.
+/// @Returns: read_exact returns false if fd was already at its end.
+static bool read_exact(int fd, char *buf, std::size_t len, const char *truncated)
+{
+    std::size_t got = 0;
+
+    while (got < len) {
+	auto n = read_some(fd, buf + got, len - got);
+	if (n == 0) {
+	    if (got == 0) {
+		return false;
+	    }
+	    fatal_errorx(truncated);
+	}
+	got += n;
+    }
+
+    return true;
+}
+
+/// @Description: Read a member payload of len bytes and skip its padding.
+/// @Returns: read_payload returns a std::string.
+static std::string read_payload(int fd, std::uint64_t len)
+{
+    std::string buf(tar::padded(len), '\0');
+    if (!buf.empty() && !read_exact(fd, buf.data(), buf.size(), "truncated tar archive.")) {
+	fatal_errorx("truncated tar archive.");
+    }
+    buf.resize(len);
+    return buf;
+}
+
+/// @Description: Filter the payload of every regular member of the tar
+///               stream on in_fd, rewriting sizes and checksums, and write
+///               the new archive to the sink. Other members pass through
+///               untouched. With jobs > 1, up to that many members are
+///               filtered at once; they are still written in archive order.
+///               Quotas start afresh for each member.
+/// @Returns: filter_tar returns a void.
+static void filter_tar(int in_fd, const xc::pattern &pat, unsigned jobs,
+		       output_sink &sink)
+{
+    std::deque<std::future<std::string>> pending;
+    std::string pass;		// Untouched blocks not yet written.
+    std::string pax_hdr, pax;	// Extended header of the next member.
+    char hdr[tar::block];
+
+    auto drain = [&](std::size_t keep) {
+	while (pending.size() > keep) {
+	    const auto entry = pending.front().get();
+	    sink.write(entry.data(), entry.size());
+	    pending.pop_front();
+	}
+    };
+
+    auto pad = [](std::string &s) {
+	s.append(tar::padded(s.size()) - s.size(), '\0');
+    };
+
+    while (read_exact(in_fd, hdr, sizeof(hdr), "truncated tar archive.")) {
+	if (tar::is_zero(hdr)) {
+	    // End of archive: keep the trailer as it was.
+	    pass.append(hdr, sizeof(hdr));
+	    char buf[64 * 1024];
+	    while (auto n = read_some(in_fd, buf, sizeof(buf))) {
+		pass.append(buf, n);
+	    }
+	    break;
+	}
+
+	auto len = tar::size(hdr);
+
+	if (tar::type(hdr) == 'x') {
+	    pax_hdr.assign(hdr, sizeof(hdr));
+	    pax = read_payload(in_fd, len);
+	    continue;
+	}
+
+	if (!tar::is_regular(hdr)) {
+	    if (!pax_hdr.empty()) {
+		pass.append(pax_hdr);
+		pass.append(pax);
+		pad(pass);
+		pax_hdr.clear();
+	    }
+	    pass.append(hdr, sizeof(hdr));
+	    pass.append(read_payload(in_fd, len));
+	    pad(pass);
+	    continue;
+	}
+
+	std::string entry;
+	entry.swap(pass);
+	if (!pax_hdr.empty()) {
+	    tar::drop_pax_size(pax, len);
+	    tar::set_size(pax_hdr.data(), pax.size());
+	    tar::fix_checksum(pax_hdr.data());
+	    entry.append(pax_hdr);
+	    entry.append(pax);
+	    pad(entry);
+	    pax_hdr.clear();
+	}
+	entry.append(hdr, sizeof(hdr));
+
+	auto task = [&pat, &pad, entry = std::move(entry),
+		     payload = read_payload(in_fd, len)]() mutable {
+	    const auto hdr_at = entry.size() - tar::block;
+	    xc::filter flt {pat};
+	    flt.run(payload.data(), payload.size(), entry);
+	    flt.finish(entry);
+
+	    tar::set_size(entry.data() + hdr_at, entry.size() - hdr_at - tar::block);
+	    tar::fix_checksum(entry.data() + hdr_at);
+	    pad(entry);
+	    return entry;
+	};
+
+	pending.push_back(std::async(jobs > 1 ? std::launch::async :
+				     std::launch::deferred, std::move(task)));
+	drain(jobs - 1);
+    }
+
+    drain(0);
+    sink.write(pass.data(), pass.size());
+}
+
+/// @Description: Run one of the kernel copy calls until the input ends.
+/// @Returns: kernel_copy returns false if the call cannot copy between
+///           these descriptors, true once everything was copied.
+template <typename Copy>
+static bool kernel_copy(Copy copy)
+{
+    for (;;) {
+	auto n = copy();
+	if (n > 0) {
+	    continue;
+	}
+	if (n == 0) {
+	    return true;
+	}
+
+	switch (errno) {
+	case EINTR:
+	    continue;
+
+	case EINVAL:
+	case EXDEV:
+	case EBADF:
+	case ENOSYS:
+	case EOPNOTSUPP:
+	    return false;
+
+	default:
+	    fatal_error("copy()");
+	}
+    }
+}
+
+/// @Description: Copy the rest of fd to the sink unfiltered. Unless the
+///               output is being hashed, the bytes never leave the kernel:
+///               copy_file_range() between files, sendfile() from a file
+///               and splice() from a pipe, whichever the descriptors allow.
+/// @Returns: passthrough returns a void.
+static void passthrough(int fd, output_sink &sink)
+{
+    constexpr std::size_t step = 1 << 30;
+
+    sink.flush();
+    // Kernel copies cannot be paced.
+    if (!sink.sum && !read_limit.limited() && !write_limit.limited()) {
+	const auto out = sink.fd;
+	if (kernel_copy([&] { return copy_file_range(fd, nullptr, out, nullptr, step, 0); }) ||
+	    kernel_copy([&] { return sendfile(out, fd, nullptr, step); }) ||
+	    kernel_copy([&] { return splice(fd, nullptr, out, nullptr, step, SPLICE_F_MOVE); })) {
+	    return;
+	}
+    }
+
+    char buf[64 * 1024];
+    while (auto n = read_some(fd, buf, sizeof(buf))) {
+	sink.write(buf, n);
+    }
+}
+
+/// @Description: Filter the input on fd chunk by chunk into the sink,
+///               writing the removals to the sidecar as they happen when
+///               sc is not null, and counting them per byte value in
+///               tally when that is not null, and writing the numbers of
+///               the lines they were on to changes_fd when changes is not
+///               null. st is what fstat() said of fd. Holes of a sparse
+///               file are not read: they are removed as a whole when NUL
+///               is removable, and written as holes again when it is
+///               untouched.
+/// @Returns: filter_stream returns a void.
+static void filter_stream(int fd, const struct stat &st, const xc::pattern &pat,
+			  output_sink &sink, sidecar::writer *sc, int sc_fd,
+			  utf8::validator *check,
+			  std::array<std::uint64_t, 256> *tally,
+			  line_changes::tracker *changes, int changes_fd)
+{
+    // A small file is read whole, plus one byte to see its end at once.
+    std::size_t chunk = 256 * 1024;
+    const bool regular = S_ISREG(st.st_mode);
+    if (regular && static_cast<std::uint64_t>(st.st_size) < chunk) {
+	chunk = static_cast<std::size_t>(st.st_size) + 1;
+    }
+
+    // Only files with fewer blocks than bytes can have holes.
+    bool sparse = regular && static_cast<std::uint64_t>(st.st_blocks) * 512 <
+	static_cast<std::uint64_t>(st.st_size);
+    off_t pos = sparse ? lseek(fd, 0, SEEK_CUR) : 0;
+    off_t data_end = pos;
+
+    auto in = std::make_unique<char[]>(chunk);
+    std::string out;
+    out.reserve(chunk);
+
+    xc::filter flt {pat};
+    auto on_remove = [sc, tally, changes](std::uint64_t off, unsigned char c) {
+	if (sc) {
+	    sc->remove(off, c);
+	}
+	if (tally) {
+	    (*tally)[c]++;
+	}
+	if (changes) {
+	    changes->removed(off);
+	}
+    };
+
+    auto flush = [&] {
+	sink.write(out.data(), out.size());
+	out.clear();
+	if (sc) {
+	    write_all(sc_fd, sc->buf.data(), sc->buf.size());
+	    sc->buf.clear();
+	}
+	if (changes) {
+	    write_all(changes_fd, changes->buf.data(), changes->buf.size());
+	    changes->buf.clear();
+	}
+    };
+
+    // Line ends are counted between removals, block by block.
+    auto shown = [&](const char *p, std::uint64_t n) {
+	if (changes) {
+	    changes->block(p, n, flt.reported_to());
+	}
+    };
+
+    auto hole = [&](std::uint64_t len) {
+	if (check) {
+	    check->zeros(len);
+	}
+
+	const auto off = flt.offset;
+	switch (flt.skip_zeros(len, out, on_remove)) {
+	case xc::filter::zeros::removed:
+	    if (sc) {
+		sc->remove_run(off, '\0', len);
+	    }
+	    if (tally) {
+		(*tally)[0] += len;
+	    }
+	    if (changes) {
+		changes->removed(off, len);
+	    }
+	    shown(nullptr, len);
+	    break;
+
+	case xc::filter::zeros::kept:
+	    shown(nullptr, len);
+	    flush();
+	    sink.zeros(len);
+	    break;
+
+	case xc::filter::zeros::scan:
+	    std::memset(in.get(), 0, chunk);
+	    for (std::uint64_t n; len; len -= n) {
+		n = std::min<std::uint64_t>(len, chunk);
+		flt.run(in.get(), n, out, on_remove);
+		shown(in.get(), n);
+		flush();
+	    }
+	    break;
+	}
+    };
+
+    // Validation has to see every byte, even once there is nothing left to
+    // remove.
+    while (check || !flt.spent()) {
+	auto want = chunk;
+
+	if (sparse && pos >= data_end) {
+	    auto data = lseek(fd, pos, SEEK_DATA);
+	    if (data == -1 && errno == ENXIO) {
+		// Nothing but a hole up to the end of the file.
+		data = std::max<off_t>(pos, lseek(fd, 0, SEEK_END));
+	    }
+	    if (data == -1) {
+		// SEEK_DATA is not supported here: read everything.
+		sparse = false;
+		lseek(fd, pos, SEEK_SET);
+		continue;
+	    }
+
+	    hole(data - pos);
+	    pos = data;
+	    data_end = lseek(fd, pos, SEEK_HOLE);
+	    if (data_end == -1 && errno == ENXIO) {
+		break;
+	    }
+	    if (data_end == -1 || lseek(fd, pos, SEEK_SET) == -1) {
+		fatal_error("lseek()");
+	    }
+	}
+
+	if (sparse) {
+	    want = std::min<std::uint64_t>(chunk, data_end - pos);
+	}
+
+	auto n = read_some(fd, in.get(), want);
+	if (n == 0) {
+	    break;
+	}
+	pos += n;
+	if (check) {
+	    check->feed(in.get(), n);
+	}
+	flt.run(in.get(), n, out, on_remove);
+	shown(in.get(), n);
+	flush();
+    }
+
+    if (!check && flt.spent()) {
+	passthrough(fd, sink);
+    }
+
+    flt.finish(out, on_remove);
+    if (sc) {
+	sc->finish();
+    }
+    if (changes) {
+	changes->finish();
+    }
+    flush();
+}
+
+/// @Description: Filter between two pipes without copying clean data
+///               through user space. Each block waiting in the input pipe
+///               is duplicated with tee() and inspected; a block with
+///               nothing to remove is spliced straight to the output pipe,
+///               and only the others are read and filtered.
+/// @Returns: filter_pipe returns a void.
+static void filter_pipe(int fd, const xc::pattern &pat, output_sink &sink,
+			sidecar::writer *sc, int sc_fd)
+{
+    constexpr int pipe_size = 1024 * 1024;
+
+    int peek[2];
+    if (pipe(peek) == -1) {
+	fatal_error("pipe()");
+    }
+
+    auto null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1) {
+	fatal_error("open()");
+    }
+
+    // Larger pipes batch more per call; the limit may refuse, that's fine.
+    for (const auto p : {fd, sink.fd, peek[0]}) {
+	fcntl(p, F_SETPIPE_SZ, pipe_size);
+    }
+    const auto block = static_cast<std::size_t>(
+	std::max(fcntl(peek[0], F_GETPIPE_SZ), 4096));
+
+    auto in = std::make_unique<char[]>(block);
+    std::string out;
+    out.reserve(block);
+
+    xc::filter flt {pat};
+    auto on_remove = [sc](std::uint64_t off, unsigned char c) {
+	if (sc) {
+	    sc->remove(off, c);
+	}
+    };
+
+    // Move exactly len bytes from the input pipe to `to` in the kernel.
+    auto move = [fd](int to, std::size_t len) {
+	while (len) {
+	    auto n = splice(fd, nullptr, to, nullptr, len, SPLICE_F_MOVE);
+	    if (n == -1 && errno == EINTR) {
+		continue;
+	    }
+	    if (n <= 0) {
+		fatal_error("splice()");
+	    }
+	    len -= static_cast<std::size_t>(n);
+	}
+    };
+
+    while (!flt.spent()) {
+	auto n = tee(fd, peek[1], block, 0);
+	if (n == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    fatal_error("tee()");
+	}
+	if (n == 0) {
+	    break;
+	}
+
+	const auto len = static_cast<std::size_t>(n);
+	if (!read_exact(peek[0], in.get(), len, "lost data from the input pipe.")) {
+	    fatal_errorx("lost data from the input pipe.");
+	}
+
+	if (flt.clean(in.get(), len)) {
+	    sink.flush();
+	    if (sink.sum) {
+		sink.sum->update(in.get(), len);
+	    }
+	    move(sink.fd, len);
+	    flt.skip_clean(len);
+	    continue;
+	}
+
+	move(null_fd, len);
+	flt.run(in.get(), len, out, on_remove);
+	sink.write(out.data(), out.size());
+	out.clear();
+	if (sc) {
+	    write_all(sc_fd, sc->buf.data(), sc->buf.size());
+	    sc->buf.clear();
+	}
+    }
+
+    if (flt.spent()) {
+	passthrough(fd, sink);
+    }
+
+    flt.finish(out, on_remove);
+    if (sc) {
+	sc->finish();
+	write_all(sc_fd, sc->buf.data(), sc->buf.size());
+    }
+    sink.write(out.data(), out.size());
+
+    close(null_fd);
+    close(peek[0]);
+    close(peek[1]);
+}
+
+/// @Description: Filter for low latency: whatever the input has ready is
+///               read at once and filtered, and the output is
+///               flushed as soon as the input runs dry, so every complete
+///               line goes out right away while a burst still leaves in
+///               large writes. With a live pattern, its latest version
+///               takes over at the first line start that ends a read.
+/// @Returns: filter_lines returns a void.
+static void filter_lines(int fd, const xc::pattern &pat, output_sink &sink,
+			 sidecar::writer *sc, int sc_fd,
+			 rcu::cell<xc::pattern> *live)
+{
+    constexpr std::size_t chunk = 64 * 1024;
+
+    auto in = std::make_unique<char[]>(chunk);
+    std::string out;
+    out.reserve(chunk);
+
+    // The version in use stays announced, so it is not freed under us.
+    std::optional<rcu::cell<xc::pattern>::reader> rd;
+    const xc::pattern *cur = &pat;
+    if (live) {
+	rd.emplace(*live, 0);
+	cur = rd->get();
+    }
+
+    xc::filter flt {*cur};
+    auto on_remove = [sc](std::uint64_t off, unsigned char c) {
+	if (sc) {
+	    sc->remove(off, c);
+	}
+    };
+
+    auto flush = [&] {
+	sink.write(out.data(), out.size());
+	sink.flush();
+	out.clear();
+	if (sc) {
+	    write_all(sc_fd, sc->buf.data(), sc->buf.size());
+	    sc->buf.clear();
+	}
+    };
+
+    // Spent quotas still go through this loop rather than passthrough(),
+    // whose buffered copy would hold lines back.
+    bool line_end = true;	// The last read ended a line.
+    for (;;) {
+	// The descriptor stays blocking, as it may be shared with a
+	// terminal: poll() tells whether input is waiting, and the read
+	// then takes whatever is there.
+	pollfd pfd {fd, POLLIN, 0};
+	auto ready = poll(&pfd, 1, 0);
+	if (ready == 0) {
+	    // Drained for now: send what we have, then wait for more.
+	    flush();
+	    ready = poll(&pfd, 1, -1);
+	}
+	if (ready == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    fatal_error("poll()");
+	}
+
+	const auto n = read_some(fd, in.get(), chunk);
+	if (n == 0) {
+	    break;
+	}
+	if (rd && line_end && rd->stale(cur) && flt.settled()) {
+	    cur = rd->get();
+	    flt.rebind(*cur);
+	}
+	if (flt.spent()) {
+	    out.append(in.get(), n);
+	    flt.skip_clean(n);
+	} else {
+	    flt.run(in.get(), n, out, on_remove);
+	}
+	line_end = in[n - 1] == '\n';
+	if (out.size() >= chunk) {
+	    flush();
+	}
+    }
+
+    flt.finish(out, on_remove);
+    if (sc) {
+	sc->finish();
+    }
+    flush();
+}
+
+/// @Description: Exit with the offset of the first byte check rejected.
+/// @Returns: fatal_invalid returns a void.
+[[noreturn]]
+static void fatal_invalid(const utf8::validator &check)
 {
-    std::cerr << "error: " << emsg << '\n';
-    std::exit(1);
+    fatal_errorx(std::string("input is not valid ") +
+		 (check.ascii ? "ASCII" : "UTF-8") +
+		 " at byte " + std::to_string(check.bad) + ".");
 }
 
-/// @Description: Read a file and return the unique pointer to the caller.
-/// @Returns: read_file returns a std::string.
-static std::string read_file(const std::string_view &fname)
+/// @Description: Only validate the input, stopping at the first invalid
+///               byte.
+/// @Returns: validate_stream returns a void.
+static void validate_stream(int fd, utf8::validator &check)
 {
-    auto fd = open(fname.data(), O_RDONLY);
-    if (fd == -1) {
-        fatal_error("open()");
-    }
+    constexpr std::size_t chunk = 256 * 1024;
+    auto in = std::make_unique<char[]>(chunk);
 
-    auto file_size = std::filesystem::file_size(fname);
-    auto m_buf = std::make_unique<char[]>(file_size + 1);
+    while (auto n = read_some(fd, in.get(), chunk)) {
+	if (!check.feed(in.get(), n)) {
+	    fatal_invalid(check);
+	}
+    }
 
-    read(fd, m_buf.get(), file_size);
-    return m_buf.get();
+    if (!check.finish()) {
+	fatal_invalid(check);
+    }
 }
 
-/// @Description: Look for a specific set of characters in the provided
-///               source, and then erase them individually from the source.
-/// @Returns: look_for returns a std::string.
-static std::string look_for(std::string &source, std::string &matches,
-			    std::int64_t times)
+/// @Description: One output of a fan-out run: its pattern and file.
+struct fan_out {
+    xc::pattern pat;
+    std::string path;		// Empty for the standard output.
+};
+
+/// @Description: Read the input once and filter it into several outputs,
+///               each with its own pattern. Blocks are classified once
+///               against the union of all patterns; a block none of them
+///               touches is appended to every output as is, and only the
+///               others are filtered per output. An output file that is
+///               the input is refused before anything is truncated.
+/// @Returns: filter_fan_out returns a void.
+static void filter_fan_out(int fd, const std::vector<fan_out> &outs)
 {
-    std::int64_t times_old = times;
-    std::size_t it_times = 0;
+    constexpr std::size_t chunk = 256 * 1024;
+    constexpr std::size_t block = 16 * 1024;
 
-    if (times < 0) {
-	fatal_errorx("size of how many, cannot be less than 0.");
+    simd::byteset any;
+    for (int c = 0; c < 256; c++) {
+	for (const auto &o : outs) {
+	    if (o.pat.flags[c]) {
+		any.add(static_cast<unsigned char>(c));
+		break;
+	    }
+	}
+    }
+
+    struct stat in_st;
+    if (fstat(fd, &in_st) == -1) {
+	fatal_error("fstat()");
+    }
+    for (const auto &o : outs) {
+	struct stat out_st;
+	if (!o.path.empty() && stat(o.path.c_str(), &out_st) == 0 &&
+	    in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+	    fatal_errorx(o.path + " is the input itself; pick another --out file.");
+	}
     }
 
-    for (const auto &e : matches) {
-	// Times we'll find that next character from matches.
-	while (times && (std::find(source.begin(), source.end(), e) != std::end(source))) {
-	    source.erase(std::find(source.begin(), source.end(), e));
-	    times--;
-        }
+    std::vector<xc::filter> flts;
+    std::vector<output_sink> sinks(outs.size());
+    std::vector<std::string> bufs(outs.size());
+    for (std::size_t i = 0; i < outs.size(); i++) {
+	flts.emplace_back(outs[i].pat);
+	// The standard output is written as it is, never reopened.
+	if (!outs[i].path.empty()) {
+	    sinks[i].fd = open(outs[i].path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	    if (sinks[i].fd == -1) {
+		fatal_error("open()");
+	    }
+	}
+	bufs[i].reserve(chunk);
+    }
+
+    auto in = std::make_unique<char[]>(chunk);
+    while (auto n = read_some(fd, in.get(), chunk)) {
+	for (std::size_t at = 0; at < n; at += block) {
+	    const auto p = in.get() + at;
+	    const auto len = std::min(block, n - at);
+	    const bool untouched = simd::find(any, p, len) == len;
+
+	    for (std::size_t i = 0; i < flts.size(); i++) {
+		if (flts[i].spent() || (untouched && flts[i].transparent())) {
+		    bufs[i].append(p, len);
+		    flts[i].skip_clean(len);
+		} else {
+		    flts[i].run(p, len, bufs[i]);
+		}
+	    }
+	}
 
-	// Go to the next character from the matches iterator
-	// by erasing the previous one.
-        matches.erase(matches.begin(), matches.begin());
-	times = times_old;
+	for (std::size_t i = 0; i < flts.size(); i++) {
+	    sinks[i].write(bufs[i].data(), bufs[i].size());
+	    bufs[i].clear();
+	}
     }
 
-    return source;
+    for (std::size_t i = 0; i < flts.size(); i++) {
+	flts[i].finish(bufs[i]);
+	sinks[i].write(bufs[i].data(), bufs[i].size());
+	sinks[i].flush();
+	if (!outs[i].path.empty()) {
+	    close(sinks[i].fd);
+	}
+    }
 }
 
-/// @Description: Ignore if a specific predicate matches with the provided one.
-/// @Returns: ignore_if function returns a std::string.
-template <typename Predicate>
-static inline std::string ignore_if(const std::string &source, Predicate pred)
+/// @Description: Read up to len bytes of fd at offset off, retrying on
+///               signals.
+/// @Returns: read_at returns the byte count, 0 at the end of file.
+static std::size_t read_at(int fd, char *buf, std::size_t len, std::uint64_t off)
 {
-    std::string buf;
-    for (const auto &item : source) {
-	if (!pred(item)) {
-	    buf.push_back(item);
+    for (;;) {
+	auto n = pread(fd, buf, read_limit.slice(len), static_cast<off_t>(off));
+	if (n >= 0) {
+	    read_limit.take(static_cast<std::uint64_t>(n));
+	    return static_cast<std::size_t>(n);
+	}
+	if (errno != EINTR) {
+	    fatal_error("pread()");
 	}
     }
+}
 
-    return buf;
+/// @Description: Load the line index of the file open on fd, of which
+///               fstat() said st, from path.xci, or build it when it is
+///               missing or no longer matches the file, and store it there
+///               for the next run.
+/// @Returns: load_index returns a line_index::index.
+static line_index::index load_index(const std::string &path, int fd,
+				    const struct stat &st)
+{
+    if (!S_ISREG(st.st_mode)) {
+	fatal_errorx("--index needs a regular input file.");
+    }
+
+    const auto size = static_cast<std::uint64_t>(st.st_size);
+    const auto sec = static_cast<std::uint64_t>(st.st_mtim.tv_sec);
+    const auto nsec = static_cast<std::uint64_t>(st.st_mtim.tv_nsec);
+    const auto xci = path + ".xci";
+
+    if (auto ifd = open(xci.c_str(), O_RDONLY); ifd != -1) {
+	std::string data;
+	char buf[64 * 1024];
+	while (auto n = read_some(ifd, buf, sizeof(buf))) {
+	    data.append(buf, n);
+	}
+	close(ifd);
+
+	line_index::index idx;
+	if (idx.decode(data) && idx.matches(size, sec, nsec)) {
+	    return idx;
+	}
+    }
+
+    constexpr std::size_t chunk = 1024 * 1024;
+    auto in = std::make_unique<char[]>(chunk);
+    line_index::builder b;
+    std::uint64_t off = 0;
+    while (auto n = read_at(fd, in.get(), chunk, off)) {
+	b.feed(in.get(), n);
+	off += n;
+    }
+    auto &idx = b.finish(sec, nsec);
+
+    // Written aside and renamed, so a reader never sees half an index.
+    const auto tmp = xci + ".tmp";
+    auto ofd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (ofd == -1) {
+	print_error("cannot store the index", std::strerror(errno));
+	return idx;
+    }
+    const auto data = idx.encode();
+    write_all(ofd, data.data(), data.size());
+    close(ofd);
+    if (rename(tmp.c_str(), xci.c_str()) == -1) {
+	fatal_error("rename()");
+    }
+
+    return idx;
 }
 
-/// @Description: Helper function that calls ignore_if(), clears
-///               the std::string buffer, and append the returned
-///               string from ignore_if() function.
-/// @Returns: ignore_and_append returns a void.
-template <typename Predicate>
-static inline void ignore_and_append(std::string &buf, Predicate pred)
+/// @Description: Find where line `line` (from 0) of the file open on fd
+///               starts, from the closest indexed line before it when
+///               there is an index, else from the start of the file.
+/// @Returns: record_offset returns the offset, the file size if the file
+///           has fewer lines.
+static std::uint64_t record_offset(int fd, const line_index::index *idx,
+				   std::uint64_t line)
 {
-    const auto new_buf = ignore_if(buf, pred);
-    buf.clear();
-    buf.append(std::move(new_buf));
+    std::uint64_t off = 0;
+    if (idx) {
+	const auto k = std::min<std::uint64_t>(line / idx->every, idx->starts.size() - 1);
+	off = idx->starts[k];
+	line -= k * idx->every;
+    }
+
+    constexpr std::size_t chunk = 256 * 1024;
+    auto in = std::make_unique<char[]>(chunk);
+    while (line) {
+	const auto n = read_at(fd, in.get(), chunk, off);
+	if (n == 0) {
+	    break;
+	}
+
+	// Whole chunks are counted; only the last one is searched.
+	const auto nl = simd::count(in.get(), n, '\n');
+	if (nl < line) {
+	    line -= nl;
+	    off += n;
+	    continue;
+	}
+
+	const char *q = in.get();
+	for (; line; line--, q++) {
+	    q = static_cast<const char *>(std::memchr(q, '\n', in.get() + n - q));
+	}
+	off += static_cast<std::uint64_t>(q - in.get());
+    }
+
+    return off;
 }
 
-/// @Description: Check whether the Haystack has a specified key or not.
-/// @Returns: contains_this returns a boolean value.
-/// @Compat: This function mainly serves as for compatibility.
-template <typename HaystackSource,
-	  typename Key = std::string_view, typename =	  
-	  std::enable_if_t<std::is_same_v<HaystackSource, std::string> ||
-			   std::is_same_v<HaystackSource, std::string_view>>>
-[[nodiscard]]
-static inline bool contains_this(HaystackSource &source, const Key &key)
+/// @Description: Filter [from, size) of the regular file on fd on up to
+///               jobs threads, writing the output to the sink in file
+///               order. The file is read in windows ending at indexed line
+///               starts, and each window is split further by
+///               xc::filter_parallel(), whose helper tasks run on threads
+///               owned here. Only patterns that look no further back than
+///               the current line can be split like this.
+/// @Returns: filter_parallel returns a void.
+static void filter_parallel(int fd, const xc::pattern &pat,
+			    const line_index::index &idx, std::uint64_t from,
+			    unsigned jobs, output_sink &sink)
 {
-    return source.find(key) != std::string::npos;
+    constexpr std::size_t piece = 1024 * 1024;
+    const std::uint64_t window = std::uint64_t {jobs} * piece * 4;
+
+    std::vector<std::future<void>> helpers;
+    const xc::executor submit = [&helpers](std::function<void()> task) {
+	helpers.push_back(std::async(std::launch::async, std::move(task)));
+    };
+
+    std::string in;
+    auto next = idx.starts.begin();
+    while (from < idx.size) {
+	next = std::lower_bound(next, idx.starts.end(), from + window);
+	const auto to = next == idx.starts.end() ? idx.size : *next;
+
+	in.resize(to - from);
+	for (std::size_t got = 0; got < in.size();) {
+	    const auto n = read_at(fd, in.data() + got, in.size() - got, from + got);
+	    if (n == 0) {
+		fatal_errorx("input file changed while filtering.");
+	    }
+	    got += n;
+	}
+
+	xc::filter_parallel(pat, in, submit, jobs, [&sink](std::string_view out) {
+	    sink.write(out.data(), out.size());
+	}, piece);
+
+	for (auto &h : helpers) {
+	    h.get();
+	}
+	helpers.clear();
+	from = to;
+    }
 }
 
-/// @Description: Matches argument to check whether the argument is equal
-///               to the expected one.
-/// @Returns: run_args function returns a void.
-static void match_args(std::string &args, std::string &buf)
+/// @Description: Filter the input with pat, when there is one, and write
+///               it with the bytes of the table shown escaped.
+/// @Returns: show_stream returns a void.
+static void show_stream(int fd, const xc::pattern *pat, const show::table &t,
+			output_sink &sink)
 {
-    if (contains_this(args, "[:alnum:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return char_type::isalnum(c);
-	});
+    constexpr std::size_t chunk = 256 * 1024;
+    auto in = std::make_unique<char[]>(chunk);
+    std::string kept, out;
+    out.reserve(chunk * show::max_escape);
+
+    std::unique_ptr<xc::filter> flt;
+    if (pat) {
+	flt = std::make_unique<xc::filter>(*pat);
+	kept.reserve(chunk);
     }
 
-    if (contains_this(args, "[:alpha:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return char_type::isalpha(c);
-	});
+    auto emit = [&](const char *p, std::size_t n) {
+	show::expand(t, p, n, out);
+	sink.write(out.data(), out.size());
+	out.clear();
+    };
+
+    while (auto n = read_some(fd, in.get(), chunk)) {
+	if (!flt) {
+	    emit(in.get(), n);
+	    continue;
+	}
+	flt->run(in.get(), n, kept);
+	emit(kept.data(), kept.size());
+	kept.clear();
     }
 
-    if (contains_this(args, "[:blank:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return char_type::isblank(c);
-	});
+    if (flt) {
+	flt->finish(kept);
+	emit(kept.data(), kept.size());
     }
+}
 
-    if (contains_this(args, "[:cntrl:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return char_type::iscntrl(c);
-	});
+/// @Description: Test whether fd is a pipe.
+/// @Returns: is_pipe returns a boolean value.
+static bool is_pipe(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+/// @Description: What batch mode does with files that look binary.
+enum class binary_policy {
+    filter,
+    skip,
+    copy,
+};
+
+/// @Description: Counters printed at the end of a batch run with --stats.
+struct batch_stats {
+    std::uint64_t files = 0;
+    std::uint64_t binary = 0;
+    std::uint64_t skipped = 0;
+    std::uint64_t copied = 0;
+};
+
+/// @Description: Settings shared by every file of a batch run.
+struct batch_job {
+    const xc::pattern *pat;
+    const xc::pattern *binary_pat;	// For binary files, if not null.
+    binary_policy binary;
+    batch_stats stats;
+    report::writer *report;		// For --report, if not null.
+};
+
+/// @Description: Guess whether a block is binary, like grep does: it has
+///               a NUL byte, or more than 1/32 of it is not valid UTF-8.
+/// @Returns: looks_binary returns a boolean value.
+static bool looks_binary(const char *p, std::size_t n)
+{
+    return simd::count(p, n, '\0') || utf8::count_invalid(p, n) * 32 > n;
+}
+
+/// @Description: CPU time of the calling thread.
+/// @Returns: thread_cpu_ns returns nanoseconds.
+static std::uint64_t thread_cpu_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000 +
+	static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
+/// @Description: Filter one file of a batch run into out_path. The first
+///               block decides whether the file is binary, and then the
+///               binary policy whether it is filtered, copied as is, or
+///               skipped without creating out_path. With a report, what
+///               was done is queued to it.
+/// @Returns: filter_file returns a void.
+static void filter_file(const std::string &in_path, const std::string &out_path,
+			batch_job &job)
+{
+    constexpr std::size_t head = 64 * 1024;
+
+    report::file_record rec;
+    const auto wall = throttle::now_ns();
+    const auto cpu = job.report ? thread_cpu_ns() : 0;
+    auto done = [&](std::string_view engine) {
+	if (!job.report) {
+	    return;
+	}
+	rec.path = in_path;
+	rec.engine = engine;
+	rec.wall_ns = static_cast<std::uint64_t>(throttle::now_ns() - wall);
+	rec.cpu_ns = thread_cpu_ns() - cpu;
+	job.report->push(std::move(rec));
+    };
+
+    auto fd = open_input(in_path);
+    struct stat in_st;
+    if (fstat(fd, &in_st) == -1) {
+	fatal_error("fstat()");
     }
 
-    if (contains_this(args, "[:digit:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return char_type::isdigit(c);
-	});
+    auto buf = std::make_unique<char[]>(head);
+    ssize_t n;
+    while ((n = pread(fd, buf.get(), head, 0)) == -1 && errno == EINTR) {
+    }
+    if (n == -1) {
+	fatal_error("pread()");
     }
 
-    if (contains_this(args, "[:graph:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return char_type::isgraph(c);
-	});
+    job.stats.files++;
+    const bool binary = looks_binary(buf.get(), static_cast<std::size_t>(n));
+    rec.binary = binary;
+    if (binary) {
+	job.stats.binary++;
+	if (job.binary == binary_policy::skip) {
+	    job.stats.skipped++;
+	    rec.bytes_in = static_cast<std::uint64_t>(in_st.st_size);
+	    close(fd);
+	    done("skip");
+	    return;
+	}
     }
 
-    if (contains_this(args, "[:lower:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return char_type::islower(c);
-	});
+    // Truncating the output must not destroy the input.
+    struct stat out_st;
+    if (stat(out_path.c_str(), &out_st) == 0 &&
+	in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+	fatal_errorx(out_path + " is the input itself; pick another output directory.");
     }
 
-    if (contains_this(args, "[:print:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return char_type::isprint(c);
-	});
+    output_sink sink;
+    sink.fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (sink.fd == -1) {
+	fatal_error("open()");
     }
+    rec.out = out_path;
 
-    if (contains_this(args, "[:punct:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return char_type::ispunct(c);
-	});
+    std::string_view engine = "stream";
+    if (binary && job.binary == binary_policy::copy) {
+	job.stats.copied++;
+	passthrough(fd, sink);
+	engine = "copy";
+    } else {
+	const auto &pat = (binary && job.binary_pat) ? *job.binary_pat : *job.pat;
+	filter_stream(fd, in_st, pat, sink, nullptr, -1, nullptr,
+		      job.report ? &rec.removed : nullptr, nullptr, -1);
     }
 
-    if (contains_this(args, "[:space:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return char_type::isaspace(c);
-	});
+    sink.flush();
+    struct stat st;
+    if (job.report && fstat(sink.fd, &st) == 0) {
+	// Filtering only removes bytes, and they were all counted.
+	rec.bytes_out = static_cast<std::uint64_t>(st.st_size);
+	rec.bytes_in = rec.bytes_out;
+	for (const auto k : rec.removed) {
+	    rec.bytes_in += k;
+	}
     }
+    close(sink.fd);
+    close(fd);
+    done(engine);
+}
+
+/// @Description: Filter every input into out_dir. A directory input is
+///               walked recursively and mirrored under out_dir, which is
+///               left out of the walk when it lies inside; a file input
+///               lands in out_dir under its own name.
+/// @Returns: filter_batch returns a void.
+static void filter_batch(const std::vector<std::string> &inputs,
+			 const std::string &out_dir, batch_job &job)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::create_directories(out_dir, ec);
+
+    for (const auto &input : inputs) {
+	if (!fs::is_directory(input, ec)) {
+	    filter_file(input, fs::path(out_dir) / fs::path(input).filename(), job);
+	    continue;
+	}
 
-    if (contains_this(args, "[:htab:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return (char_type::ishtab(c));
-	});
+	if (fs::equivalent(input, out_dir, ec)) {
+	    fatal_errorx(input + " is the output directory itself.");
+	}
+
+	for (fs::recursive_directory_iterator it {input, ec}, end; !ec && it != end;
+	     it.increment(ec)) {
+	    if (it->is_directory(ec) && fs::equivalent(it->path(), out_dir, ec)) {
+		it.disable_recursion_pending();
+		continue;
+	    }
+	    if (!it->is_regular_file(ec)) {
+		continue;
+	    }
+
+	    const auto out = fs::path(out_dir) / fs::relative(it->path(), input, ec);
+	    fs::create_directories(out.parent_path(), ec);
+	    filter_file(it->path(), out, job);
+	}
+	if (ec) {
+	    fatal_errorx(input + ": " + ec.message());
+	}
     }
+}
 
-    if (contains_this(args, "[:vtab:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return (char_type::ishtab(c));
-	});
+/// @Description: Read a --pattern-file: the pattern argument as it would
+///               be written on the command line, a final line end aside.
+/// @Returns: read_pattern_file returns false if the file cannot be read.
+static bool read_pattern_file(const std::string &path, std::string &text)
+{
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+	return false;
     }
 
-    if (contains_this(args, "[:newline:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return (char_type::isnewline(c));
-	});
+    text.clear();
+    char buf[4096];
+    while (auto n = read_some(fd, buf, sizeof(buf))) {
+	text.append(buf, n);
     }
+    close(fd);
 
-    if (contains_this(args, "[:upper:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return (char_type::isupper(c));
-	});
+    if (!text.empty() && text.back() == '\n') {
+	text.pop_back();
     }
+    return true;
+}
+
+/// @Description: Reload the --pattern-file on every SIGHUP, which the
+///               calling thread must have blocked, and publish the new
+///               pattern to live. A file that cannot be read or names an
+///               unknown pretype is reported, and the pattern kept.
+/// @Returns: reload_patterns does not return.
+[[noreturn]]
+static void reload_patterns(const std::string path,
+			    const std::function<xc::pattern(const std::string &)> compile,
+			    rcu::cell<xc::pattern> &live)
+{
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+
+    for (;;) {
+	int sig;
+	if (sigwait(&hup, &sig) != 0) {
+	    continue;
+	}
+
+	std::string text;
+	bool unknown = false;
+	if (!read_pattern_file(path, text)) {
+	    print_error("cannot reload " + path, std::strerror(errno));
+	    continue;
+	}
+	tokenize_pattern(text, &unknown);
+	if (unknown) {
+	    print_error("cannot reload " + path, "unknown pretype in pattern");
+	    continue;
+	}
 
-    if (contains_this(args, "[:xdigit:]")) {
-	ignore_and_append(buf, [](int c) {
-	    return (char_type::isxdigit(c));
-	});
+	live.publish(std::make_unique<const xc::pattern>(compile(text)));
     }
 }
 
+/// @Description: SIGUSR1 handler: lift the --bwlimit limit, or restore it.
+/// @Returns: toggle_bwlimit() does not return anything.
+static void toggle_bwlimit(int)
+{
+    read_limit.on = !read_limit.on;
+    write_limit.on = !write_limit.on;
+}
+
 /// @Description: Print the usage of this program.
 /// @Returns: print_usage() does not return anything.
 [[noreturn]]
 static void print_usage()
 {
-    std::cout << "Usage:\n"
-	      << " -h    Prints this help message\n"
-	      << " -f    Specify the input file\n"
-	      << " -l    Specify how many non-pretyped characters to remove\n\n"
-	      << "Pretypes:\n"
-	      << " [:alnum:], [:alpha:], [:blank:], [:cntrl:], [:digit:]\n"
-	      << " [:graph:], [:lower:], [:print:], [:punct:], [:space:]\n"
-	      << " [:htab:], [:vtab:], [:newline:], [:upper:], [:xdigit:]\n";
+    static constexpr std::string_view usage =
+	"Usage:\n"
+	" -h    Prints this help message\n"
+	" -f    Specify the input file\n"
+	" -l    Specify how many non-pretyped characters to remove\n"
+	" -s    Write (or with -r, read) the sidecar of removed bytes\n"
+	" -r    Restore the original of the -f file using the -s sidecar\n"
+	" -j    Filter up to this many tar members, or with --index pieces\n"
+	"       of the input, at once\n"
+	" --tar Filter the regular members of the tar archive given by -f\n"
+	" --crlf\n"
+	"       Turn CRLF line ends into LF\n"
+	" --squeeze-blank\n"
+	"       Collapse runs of empty lines into one\n"
+	" --strip-invisible\n"
+	"       Remove zero-width characters, bidi controls and BOMs\n"
+	" --cut-cols=LIST\n"
+	"       Remove these byte columns of every line, e.g. 1-20,31-\n"
+	" --truncate=N\n"
+	"       Remove everything past column N of every line\n"
+	" -o    Filter every -f file or directory into this directory\n"
+	" --binary=filter|skip|copy\n"
+	"       With -o, what to do with files that look binary\n"
+	" --binary-pattern=PATTERN\n"
+	"       With -o, filter binary files with PATTERN instead\n"
+	" --stats\n"
+	"       With -o, print file counts to stderr at the end\n"
+	" --report=FILE\n"
+	"       With -o, write a JSON line per file to FILE: bytes in and\n"
+	"       out, removals per class, engine, wall and CPU time\n"
+	" --line-buffered\n"
+	"       Write each line as soon as it is complete\n"
+	" --out PATTERN=FILE\n"
+	"       Also filter the input with PATTERN into FILE; may repeat\n"
+	" --validate=ascii|utf8\n"
+	"       Check the input encoding and report the first invalid byte;\n"
+	"       without a pattern, stop there\n"
+	" --index\n"
+	"       Use the line index FILE.xci of the -f file, building it first\n"
+	"       if it is missing or stale\n"
+	" --from-record=N\n"
+	"       Start at line N of the -f file\n"
+	" --explain\n"
+	"       Print how the pattern compiles and runs, with a cost estimate\n"
+	"       from the start of the -f file if given, and exit\n"
+	" --show=CLASSES\n"
+	"       Show the bytes of these pretypes and literals escaped instead,\n"
+	"       or with \"all\" what cat -v shows; a pattern, if given, still\n"
+	"       removes bytes first\n"
+	" --notation=caret|hex\n"
+	"       With --show, write ^X and M-X as cat -v (default) or \\xNN\n"
+	" --pattern-file=FILE\n"
+	"       Read the pattern from FILE; with --line-buffered, SIGHUP\n"
+	"       reads it again and the new pattern applies from the next line\n"
+	" --bwlimit=RATE\n"
+	"       Read and write at most RATE bytes a second, e.g. 500K or 20M;\n"
+	"       SIGUSR1 turns the limit off and on again\n"
+	" --changed-lines[=FILE]\n"
+	"       Write the number of every line something was removed from\n"
+	"       to stderr, or to FILE\n"
+	" --changed-counts\n"
+	"       As --changed-lines, with how much was removed from each line\n"
+	" --checksum[=FILE]\n"
+	"       Print the CRC32C of the output to stderr, or to FILE\n\n"
+	"Pretypes:\n"
+	" [:alnum:], [:alpha:], [:blank:], [:cntrl:], [:digit:]\n"
+	" [:graph:], [:lower:], [:print:], [:punct:], [:space:]\n"
+	" [:htab:], [:vtab:], [:newline:], [:upper:], [:xdigit:]\n";
+
+    write_all(STDOUT_FILENO, usage.data(), usage.size());
     std::exit(1);
 }
 
@@ -235,10 +1798,70 @@ int main(int argc, char **argv)
     }
 
     std::int32_t opt;
-    std::string file_name;
+    std::vector<std::string> inputs;
+    std::string out_dir;
+    std::string sidecar_name;
+    std::string checksum_name;
+    bool restore_mode = false;
+    bool checksum = false;
+    bool tar_mode = false;
+    bool crlf = false;
+    bool squeeze = false;
+    bool stats = false;
+    bool line_buffered = false;
+    bool validate = false;
+    bool invisible = false;
+    const char *cut_cols = nullptr;
+    std::optional<std::uint64_t> truncate_at;
+    bool use_index = false;
+    std::uint64_t from_record = 0;
+    bool explain = false;
+    const char *show_classes = nullptr;
+    const char *pattern_file = nullptr;
+    const char *report_name = nullptr;
+    bool changed = false;
+    std::string changes_name;
+    line_changes::tracker changes;
+    auto notation = show::notation::caret;
+    utf8::validator check;
+    unsigned jobs = 1;
+    auto binary = binary_policy::filter;
+    const char *binary_pattern = nullptr;
+    std::vector<std::string> fan_specs;
     std::int64_t look_lim = std::numeric_limits<std::int64_t>::max();
 
-    while ((opt = getopt(argc, argv, "hl:f:")) != -1) {
+    static const struct option long_opts[] = {
+	{"help",    no_argument,       nullptr, 'h'},
+	{"sidecar", required_argument, nullptr, 's'},
+	{"restore", no_argument,       nullptr, 'r'},
+	{"checksum", optional_argument, nullptr, 'C'},
+	{"tar",     no_argument,       nullptr, 'T'},
+	{"jobs",    required_argument, nullptr, 'j'},
+	{"crlf",    no_argument,       nullptr, 'R'},
+	{"squeeze-blank", no_argument, nullptr, 'S'},
+	{"binary",  required_argument, nullptr, 'B'},
+	{"binary-pattern", required_argument, nullptr, 'P'},
+	{"stats",   no_argument,       nullptr, 'A'},
+	{"line-buffered", no_argument, nullptr, 'L'},
+	{"out",     required_argument, nullptr, 'O'},
+	{"validate", required_argument, nullptr, 'V'},
+	{"strip-invisible", no_argument, nullptr, 'I'},
+	{"cut-cols", required_argument, nullptr, 'K'},
+	{"truncate", required_argument, nullptr, 'N'},
+	{"index",   no_argument,       nullptr, 'X'},
+	{"from-record", required_argument, nullptr, 'F'},
+	{"explain", no_argument,       nullptr, 'E'},
+	{"show",    required_argument, nullptr, 'W'},
+	{"notation", required_argument, nullptr, 'H'},
+	{"bwlimit", required_argument, nullptr, 'Z'},
+	{"pattern-file", required_argument, nullptr, 'G'},
+	{"report",  required_argument, nullptr, 'J'},
+	{"changed-lines", optional_argument, nullptr, 'D'},
+	{"changed-counts", no_argument, nullptr, 'Y'},
+	{nullptr,   0,                 nullptr, 0},
+    };
+
+    while ((opt = getopt_long(argc, argv, "hl:f:s:rj:o:", long_opts, nullptr)) != -1) {
 	switch (opt) {
 	case 'h':
 	    print_usage();
@@ -250,7 +1873,153 @@ int main(int argc, char **argv)
 	    break;
 
 	case 'f':
-	    file_name.append(optarg);
+	    inputs.push_back(optarg);
+	    break;
+
+	case 'o':
+	    out_dir = optarg;
+	    break;
+
+	case 'B':
+	    if (std::string_view(optarg) == "filter") {
+		binary = binary_policy::filter;
+	    } else if (std::string_view(optarg) == "skip") {
+		binary = binary_policy::skip;
+	    } else if (std::string_view(optarg) == "copy") {
+		binary = binary_policy::copy;
+	    } else {
+		fatal_errorx("--binary takes filter, skip or copy.");
+	    }
+	    break;
+
+	case 'P':
+	    binary_pattern = optarg;
+	    break;
+
+	case 'A':
+	    stats = true;
+	    break;
+
+	case 'L':
+	    line_buffered = true;
+	    break;
+
+	case 'O':
+	    fan_specs.push_back(optarg);
+	    break;
+
+	case 'V':
+	    validate = true;
+	    if (std::string_view(optarg) == "ascii") {
+		check.ascii = true;
+	    } else if (std::string_view(optarg) != "utf8") {
+		fatal_errorx("--validate takes ascii or utf8.");
+	    }
+	    break;
+
+	case 's':
+	    sidecar_name = optarg;
+	    break;
+
+	case 'r':
+	    restore_mode = true;
+	    break;
+
+	case 'T':
+	    tar_mode = true;
+	    break;
+
+	case 'j':
+	    jobs = std::max(1, std::atoi(optarg));
+	    break;
+
+	case 'R':
+	    crlf = true;
+	    break;
+
+	case 'I':
+	    invisible = true;
+	    break;
+
+	case 'K':
+	    cut_cols = optarg;
+	    break;
+
+	case 'N': {
+	    char *end;
+	    errno = 0;
+	    truncate_at = std::strtoull(optarg, &end, 10);
+	    if (*optarg < '0' || *optarg > '9' || *end || errno == ERANGE) {
+		fatal_errorx("--truncate takes a column number like 80.");
+	    }
+	    break;
+	}
+
+	case 'X':
+	    use_index = true;
+	    break;
+
+	case 'E':
+	    explain = true;
+	    break;
+
+	case 'W':
+	    show_classes = optarg;
+	    break;
+
+	case 'H':
+	    if (std::string_view(optarg) == "caret") {
+		notation = show::notation::caret;
+	    } else if (std::string_view(optarg) == "hex") {
+		notation = show::notation::hex;
+	    } else {
+		fatal_errorx("--notation takes caret or hex.");
+	    }
+	    break;
+
+	case 'D':
+	    changed = true;
+	    if (optarg) {
+		changes_name = optarg;
+	    }
+	    break;
+
+	case 'Y':
+	    changed = true;
+	    changes.counts = true;
+	    break;
+
+	case 'J':
+	    report_name = optarg;
+	    break;
+
+	case 'G':
+	    pattern_file = optarg;
+	    break;
+
+	case 'Z':
+	    read_limit.rate = write_limit.rate = throttle::parse_rate(optarg);
+	    if (!read_limit.rate) {
+		fatal_errorx("--bwlimit takes a rate like 20M.");
+	    }
+	    break;
+
+	case 'F':
+	    from_record = std::strtoull(optarg, nullptr, 10);
+	    if (!from_record) {
+		fatal_errorx("--from-record counts records from 1.");
+	    }
+	    break;
+
+	case 'S':
+	    squeeze = true;
+	    break;
+
+	case 'C':
+	    checksum = true;
+	    if (optarg) {
+		checksum_name = optarg;
+	    }
 	    break;
 
 	default:
@@ -261,23 +2030,340 @@ int main(int argc, char **argv)
     argc -= optind;
     argv += optind;
 
-    if (!std::filesystem::exists(file_name)) {
-	fatal_errorx("input file path was not found.");
+    std::string pattern_text;
+    if (pattern_file) {
+	if (argv[0]) {
+	    fatal_errorx("a pattern cannot be given with --pattern-file.");
+	}
+	if (!read_pattern_file(pattern_file, pattern_text)) {
+	    fatal_error("open()");
+	}
+    }
+    const char *pattern_arg = pattern_file ? pattern_text.c_str() : argv[0];
+
+    if (inputs.size() > 1 && out_dir.empty()) {
+	fatal_errorx("several inputs need an output directory (-o).");
+    }
+    const std::string file_name = inputs.empty() ? "" : inputs[0];
+
+    if (validate && (restore_mode || tar_mode || !out_dir.empty() ||
+		     !fan_specs.empty() || line_buffered)) {
+	fatal_errorx("--validate cannot be combined with -r, --tar, -o, --out or --line-buffered.");
+    }
+
+    if ((use_index || from_record) && (restore_mode || tar_mode ||
+				       !out_dir.empty() || !fan_specs.empty())) {
+	fatal_errorx("--index and --from-record cannot be combined with -r, --tar, -o or --out.");
+    }
+
+    if (changed && (restore_mode || tar_mode || !out_dir.empty() ||
+		    !fan_specs.empty() || show_classes || line_buffered)) {
+	fatal_errorx("--changed-lines cannot be combined with -r, --tar, -o, --out, --show or --line-buffered.");
+    }
+
+    if (report_name && out_dir.empty()) {
+	fatal_errorx("--report needs an output directory (-o).");
+    }
+
+    if (show_classes && (restore_mode || tar_mode || !out_dir.empty() ||
+			 !fan_specs.empty() || !sidecar_name.empty() ||
+			 line_buffered || validate)) {
+	fatal_errorx("--show cannot be combined with -r, --tar, -o, --out, -s, --line-buffered or --validate.");
+    }
+
+    if (read_limit.rate) {
+	struct sigaction sa {};
+	sa.sa_handler = toggle_bwlimit;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, nullptr) == -1) {
+	    fatal_error("sigaction()");
+	}
+    }
+
+    crc32c::state sum;
+    output_sink sink;
+    if (checksum) {
+	sink.sum = &sum;
+    }
+
+    if (restore_mode) {
+	if (sidecar_name.empty()) {
+	    fatal_errorx("restore needs a sidecar (-s).");
+	}
+	restore(file_name, sidecar_name, sink);
+	sink.flush();
+	if (checksum) {
+	    report_checksum(sum, checksum_name);
+	}
+	return 0;
+    }
+
+    auto compile = [&](const std::string &args) {
+	auto p = compile_pattern(args, look_lim);
+	if (crlf) {
+	    p.normalize_crlf();
+	}
+	if (squeeze) {
+	    p.squeeze_blank();
+	}
+	if (invisible) {
+	    p.strip_invisible();
+	}
+	if (cut_cols) {
+	    cut_column_list(p, cut_cols);
+	}
+	if (truncate_at) {
+	    p.cut_columns(*truncate_at + 1, std::numeric_limits<std::uint64_t>::max());
+	}
+	return p;
+    };
+
+    if (!fan_specs.empty()) {
+	if (tar_mode || !out_dir.empty() || !sidecar_name.empty() || checksum) {
+	    fatal_errorx("--out cannot be combined with --tar, -o, -s or --checksum.");
+	}
+
+	std::vector<fan_out> outs;
+	for (const auto &spec : fan_specs) {
+	    const auto eq = spec.rfind('=');
+	    if (eq == std::string::npos || eq + 1 == spec.size()) {
+		fatal_errorx("--out takes PATTERN=FILE.");
+	    }
+	    outs.push_back({compile(spec.substr(0, eq)), spec.substr(eq + 1)});
+	}
+
+	// The positional pattern, if any, still goes to the standard output.
+	if (pattern_arg) {
+	    outs.push_back({compile(pattern_arg), {}});
+	}
+
+	filter_fan_out(open_input(file_name), outs);
+	return 0;
+    }
+
+    // Rules that make a complete pattern without a positional one.
+    const bool rules = crlf || squeeze || invisible || cut_cols || truncate_at;
+
+    // Showing alone needs no pattern; with one, it shows what is kept.
+    if (show_classes) {
+	show::table t {notation};
+	std::string_view classes = show_classes;
+	if (classes == "all") {
+	    // What cat -v shows: control bytes but the tab, DEL and the
+	    // high half.
+	    for (int c = 0; c < 256; c++) {
+		if ((char_type::iscntrl(c) && c != '\t') || c >= 0x80) {
+		    t.add(static_cast<unsigned char>(c));
+		}
+	    }
+	    classes = {};
+	}
+	for (const auto &tok : tokenize_pattern(classes)) {
+	    if (tok.at != xc::anchor::anywhere) {
+		fatal_errorx("--show takes pretypes and literals without ^ or $.");
+	    }
+	    for (int c = 0; c < 256; c++) {
+		if (tok.pt ? tok.pt->test(c) != 0 : c == static_cast<unsigned char>(tok.text[0])) {
+		    t.add(static_cast<unsigned char>(c));
+		}
+	    }
+	}
+
+	std::optional<xc::pattern> pat;
+	if (pattern_arg || rules) {
+	    pat = compile(pattern_arg ? pattern_arg : "");
+	}
+
+	auto fd = open_input(file_name);
+	if (from_record) {
+	    std::optional<line_index::index> idx;
+	    if (use_index) {
+		struct stat st;
+		if (fstat(fd, &st) == -1) {
+		    fatal_error("fstat()");
+		}
+		idx = load_index(file_name, fd, st);
+	    }
+	    const auto start = record_offset(fd, idx ? &*idx : nullptr, from_record - 1);
+	    if (lseek(fd, static_cast<off_t>(start), SEEK_SET) == -1) {
+		fatal_error("lseek()");
+	    }
+	}
+
+	show_stream(fd, pat ? &*pat : nullptr, t, sink);
+	sink.flush();
+	if (checksum) {
+	    report_checksum(sum, checksum_name);
+	}
+	return 0;
     }
 
-    auto file_buf = read_file(file_name.c_str());
+    // Nothing to filter: only check the encoding.
+    if (validate && !pattern_arg && !rules) {
+	validate_stream(open_input(file_name), check);
+	return 0;
+    }
 
     // Pattern (could be an arg if limit is missing after the option "-l").
-    if (!argv[0]) {
+    if (!pattern_arg && !rules) {
         fatal_errorx("missing arguments.");
     }
-    std::string arg_v1 {argv[0]};
 
-    match_args(arg_v1, file_buf);
-    if (arg_v1.find("[:") != std::string::npos) {
-        arg_v1 = arg_v1.replace(arg_v1.find("[:"), arg_v1.rfind(":]") + 2, "");
+    auto pat = compile(pattern_arg ? pattern_arg : "");
+    if (explain) {
+	explain_pattern(pattern_arg ? pattern_arg : "", pat, file_name);
+	return 0;
+    }
+
+    if (!out_dir.empty()) {
+	if (tar_mode || !sidecar_name.empty() || checksum) {
+	    fatal_errorx("-o cannot be combined with --tar, -s or --checksum.");
+	}
+
+	std::unique_ptr<xc::pattern> binary_pat;
+	if (binary_pattern) {
+	    binary_pat = std::make_unique<xc::pattern>(compile_pattern(binary_pattern, look_lim));
+	}
+
+	std::optional<report::writer> report;
+	int report_fd = -1;
+	if (report_name) {
+	    report_fd = open(report_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	    if (report_fd == -1) {
+		fatal_error("open()");
+	    }
+	    report.emplace([report_fd](std::string_view lines) {
+		write_all(report_fd, lines.data(), lines.size());
+	    });
+	}
+
+	batch_job job {&pat, binary_pat.get(), binary, {}, report ? &*report : nullptr};
+	filter_batch(inputs, out_dir, job);
+	if (report) {
+	    // Joins the reporter once it wrote everything.
+	    report.reset();
+	    close(report_fd);
+	}
+	if (stats) {
+	    const auto line = "files: " + std::to_string(job.stats.files) +
+		", binary: " + std::to_string(job.stats.binary) +
+		" (skipped " + std::to_string(job.stats.skipped) +
+		", copied " + std::to_string(job.stats.copied) + ")\n";
+	    write_all(STDERR_FILENO, line.data(), line.size());
+	}
+	return 0;
+    }
+
+    if (tar_mode) {
+	if (!sidecar_name.empty()) {
+	    fatal_errorx("a sidecar cannot be written for tar archives.");
+	}
+
+	auto fd = open_input(file_name);
+	filter_tar(fd, pat, jobs, sink);
+	sink.flush();
+	if (checksum) {
+	    report_checksum(sum, checksum_name);
+	}
+	return 0;
+    }
+
+    auto fd = open_input(file_name);
+    struct stat in_st;
+    if (fstat(fd, &in_st) == -1) {
+	fatal_error("fstat()");
+    }
+
+    std::optional<line_index::index> idx;
+    if (use_index) {
+	idx = load_index(file_name, fd, in_st);
+    }
+
+    std::uint64_t start = 0;
+    if (from_record) {
+	if (!S_ISREG(in_st.st_mode)) {
+	    fatal_errorx("--from-record needs a regular input file.");
+	}
+	start = record_offset(fd, idx ? &*idx : nullptr, from_record - 1);
+	if (lseek(fd, static_cast<off_t>(start), SEEK_SET) == -1) {
+	    fatal_error("lseek()");
+	}
+    }
+
+    // With an index, a line-local pattern is filtered in pieces at once.
+    if (idx && jobs > 1 && pat.line_local() && sidecar_name.empty() &&
+	!line_buffered && !validate && !changed) {
+	filter_parallel(fd, pat, *idx, start, jobs, sink);
+	sink.flush();
+	if (checksum) {
+	    report_checksum(sum, checksum_name);
+	}
+	return 0;
+    }
+
+    // Between two pipes, clean blocks need not pass through user space,
+    // but validation reads them all, in the same pass as the filtering.
+    // Following a stream, the pattern file is reloaded on SIGHUP by a
+    // thread of its own; the filter only checks for a newer version.
+    std::unique_ptr<rcu::cell<xc::pattern>> live;
+    if (pattern_file && line_buffered) {
+	live = std::make_unique<rcu::cell<xc::pattern>>(
+	    std::make_unique<const xc::pattern>(pat));
+
+	sigset_t hup;
+	sigemptyset(&hup);
+	sigaddset(&hup, SIGHUP);
+	if (pthread_sigmask(SIG_BLOCK, &hup, nullptr) != 0) {
+	    fatal_errorx("cannot block SIGHUP.");
+	}
+	std::thread(reload_patterns, std::string(pattern_file),
+		    std::function<xc::pattern(const std::string &)>(compile),
+		    std::ref(*live)).detach();
+    }
+
+    int changes_fd = STDERR_FILENO;
+    if (changed && !changes_name.empty()) {
+	changes_fd = open(changes_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (changes_fd == -1) {
+	    fatal_error("open()");
+	}
+    }
+
+    const bool pipes = !validate && !changed && !read_limit.limited() &&
+	S_ISFIFO(in_st.st_mode) && is_pipe(sink.fd);
+    auto filter_fd = [&](sidecar::writer *sc, int sc_fd) {
+	if (line_buffered) {
+	    filter_lines(fd, pat, sink, sc, sc_fd, live.get());
+	} else if (pipes) {
+	    filter_pipe(fd, pat, sink, sc, sc_fd);
+	} else {
+	    filter_stream(fd, in_st, pat, sink, sc, sc_fd, validate ? &check : nullptr,
+			  nullptr, changed ? &changes : nullptr, changes_fd);
+	}
+    };
+
+    if (sidecar_name.empty()) {
+	filter_fd(nullptr, -1);
+    } else {
+	auto sc_fd = open(sidecar_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (sc_fd == -1) {
+	    fatal_error("open()");
+	}
+
+	sidecar::writer sc;
+	filter_fd(&sc, sc_fd);
+	close(sc_fd);
+    }
+    if (changes_fd != STDERR_FILENO) {
+	close(changes_fd);
     }
 
-    look_for(file_buf, arg_v1, look_lim);
-    std::cout << file_buf;
+    sink.flush();
+    if (checksum) {
+	report_checksum(sum, checksum_name);
+    }
+    if (validate && !check.finish()) {
+	fatal_invalid(check);
+    }
 }